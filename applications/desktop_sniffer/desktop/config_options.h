@@ -631,8 +631,8 @@
 
 // Enable ONE_NET_MEMORY is you are implementing the ONE-NET versions of
 // malloc and free.  If ONE_NET_MEMORY is enabled, you must define
-// ONE_NET_HEAP_SIZE and ONE_NET_HEAP_NUM_ENTRIES in
-// one_net_port_const.h.
+// ONE_NET_HEAP_SIZE, ONE_NET_HEAP_NUM_CLASSES, and
+// ONE_NET_HEAP_MIN_BLOCK_SIZE in one_net_port_const.h.
 #ifndef ONE_NET_MEMORY
     #define ONE_NET_MEMORY
 #endif
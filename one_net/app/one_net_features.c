@@ -237,6 +237,13 @@ BOOL features_route_capable(on_features_t features)
     return ((features.data_rates_extended_single_route_flags &
       ON_ROUTE_FEATURE_MASK) != 0);
 }
+
+
+BOOL features_keep_alive_slot_capable(on_features_t features)
+{
+    return (features_known(features) && (features.queue_values &
+      ON_KEEP_ALIVE_SLOT_FEATURE_MASK) != 0);
+}
 #endif
 
 
@@ -111,7 +111,12 @@ enum
     ON_QUEUE_SIZE_MASK = 0xF0,
     ON_QUEUE_SIZE_SHIFT = 4,
     ON_QUEUE_LEVEL_MASK = 0x0C,
-    ON_QUEUE_LEVEL_SHIFT = 2
+    ON_QUEUE_LEVEL_SHIFT = 2,
+    
+    //! Set if the time in a keep-alive ACK is taken as the delay until the
+    //! device's next check-in slot rather than as its keep-alive interval
+    ON_KEEP_ALIVE_SLOT_FEATURE_MASK = 0x01,
+    ON_KEEP_ALIVE_SLOT_FEATURE_SHIFT = 0
 };
 
 
@@ -188,7 +193,8 @@ enum
       #if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
       + (SINGLE_DATA_QUEUE_SIZE << ON_QUEUE_SIZE_SHIFT)
       #endif
-      + (SINGLE_QUEUE_LEVEL << ON_QUEUE_LEVEL_SHIFT),
+      + (SINGLE_QUEUE_LEVEL << ON_QUEUE_LEVEL_SHIFT)
+      + ON_KEEP_ALIVE_SLOT_FEATURE_MASK,
 
 
     THIS_DEVICE_PEERS_HOPS = 0
@@ -264,6 +270,7 @@ BOOL features_simple_client(on_features_t features);
 BOOL features_dr_channel_capable(on_features_t features);
 BOOL features_extended_single_capable(on_features_t features);
 BOOL features_route_capable(on_features_t features);
+BOOL features_keep_alive_slot_capable(on_features_t features);
 #endif
 
 //! @} ONE-NET_FEATURES_pub_func
@@ -56,6 +56,19 @@
 //! \ingroup ONE-NET_MESSAGE
 //! @{
 
+#if defined(ON_COALESCE_SINGLES) && defined(EXTENDED_SINGLE) && \
+  SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+//! Queued status messages to the same device are sent together as one
+//! ON_COALESCED_APP_MSG.
+#define ON_COALESCE_QUEUE
+
+//! How long (in ms) a status message waits in the queue for others to the
+//! same device to join it.
+#ifndef ON_COALESCE_HOLD_MS
+#define ON_COALESCE_HOLD_MS 20
+#endif
+#endif
+
 //! Header(Preamble and SOF)
 const UInt8 HEADER[] = {0x55, 0x55, 0x55, 0x33};
 
@@ -80,6 +93,82 @@ enum
 };
 
 
+#if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
+/*!
+    The queue payload buffer is split into fixed size blocks so a message can
+    be removed without moving anything else.  There is one block size for
+    payloads that fit in a regular single packet and, if EXTENDED_SINGLE is
+    defined, one for payloads up to an extended single.  The large blocks are
+    carved out of SINGLE_DATA_QUEUE_PAYLOAD_BUFFER_SIZE first, then the small
+    ones from what is left.  There is never any point in having more blocks of
+    a size than there are queue slots.  Small payloads use a large block if
+    no small block is free.
+*/
+enum
+{
+    QUEUE_SMALL_PLD_LEN = ONA_SINGLE_PACKET_PAYLOAD_LEN,
+    
+    #ifdef EXTENDED_SINGLE
+    QUEUE_LARGE_PLD_LEN = ONA_MAX_SINGLE_PACKET_PAYLOAD_LEN,
+    QUEUE_LARGE_PLD_COUNT = (SINGLE_DATA_QUEUE_PAYLOAD_BUFFER_SIZE /
+      QUEUE_LARGE_PLD_LEN > SINGLE_DATA_QUEUE_SIZE) ? SINGLE_DATA_QUEUE_SIZE :
+      SINGLE_DATA_QUEUE_PAYLOAD_BUFFER_SIZE / QUEUE_LARGE_PLD_LEN,
+    #else
+    QUEUE_LARGE_PLD_LEN = 0,
+    QUEUE_LARGE_PLD_COUNT = 0,
+    #endif
+    
+    //! Bytes of the buffer taken by the large blocks
+    QUEUE_LARGE_PLD_BYTES = QUEUE_LARGE_PLD_COUNT * QUEUE_LARGE_PLD_LEN,
+    
+    QUEUE_SMALL_PLD_COUNT = ((SINGLE_DATA_QUEUE_PAYLOAD_BUFFER_SIZE -
+      QUEUE_LARGE_PLD_BYTES) / QUEUE_SMALL_PLD_LEN > SINGLE_DATA_QUEUE_SIZE) ?
+      SINGLE_DATA_QUEUE_SIZE : (SINGLE_DATA_QUEUE_PAYLOAD_BUFFER_SIZE -
+      QUEUE_LARGE_PLD_BYTES) / QUEUE_SMALL_PLD_LEN,
+    
+    QUEUE_PLD_BUFFER_SIZE = QUEUE_LARGE_PLD_BYTES +
+      QUEUE_SMALL_PLD_COUNT * QUEUE_SMALL_PLD_LEN,
+    
+    //! Marks the end of a free block list.  The index of the next free block
+    //! is stored in the first byte of each free block.
+    QUEUE_PLD_NONE = 0xFF
+};
+#endif
+
+
+#if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+enum
+{
+    //! Heap position of a queue slot that is not in the heap.  Note that
+    //! this means SINGLE_DATA_QUEUE_SIZE must be less than 255.
+    QUEUE_SLOT_NOT_IN_HEAP = 0xFF,
+
+    QUEUE_HIGH_PRIORITY_HEAP = 0,   //!< send heap for high priority messages
+    QUEUE_LOW_PRIORITY_HEAP,        //!< send heap for everything else
+    QUEUE_NUM_SEND_HEAPS
+};
+
+
+/*!
+    \brief A binary min-heap of single data queue slots.
+
+    The heap holds indexes into single_data_queue rather than the elements
+    themselves.  pos is indexed by queue slot and holds where that slot
+    currently sits in the heap (QUEUE_SLOT_NOT_IN_HEAP if it is not in it) so
+    any element can be removed without searching for it.
+*/
+typedef struct
+{
+    UInt8 slot[SINGLE_DATA_QUEUE_SIZE]; //!< queue slots in heap order
+    UInt8 pos[SINGLE_DATA_QUEUE_SIZE];  //!< heap position of each slot
+    UInt8 size;                         //!< number of slots in the heap
+    #if SINGLE_QUEUE_LEVEL > MED_SINGLE_QUEUE_LEVEL
+    BOOL by_expire_time;                //!< TRUE if keyed on expire_time
+    #endif
+} queue_heap_t;
+#endif
+
+
 //! @} ONE-NET_MESSAGE_typedefs
 //                                  TYPEDEFS END
 //==============================================================================
@@ -96,6 +185,38 @@ enum
 static void delete_expired_queue_elements(void);
 #endif
 
+#if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
+static UInt8* queue_pld_alloc(UInt8 len);
+static void queue_pld_free(UInt8* pld);
+#endif
+
+#if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+static void queue_heap_init(queue_heap_t* const heap, BOOL by_expire_time);
+static BOOL queue_heap_before(const queue_heap_t* const heap, UInt8 slot_a,
+  UInt8 slot_b);
+static void queue_heap_swap(queue_heap_t* const heap, UInt8 i, UInt8 j);
+static void queue_heap_sift_up(queue_heap_t* const heap, UInt8 i);
+static void queue_heap_sift_down(queue_heap_t* const heap, UInt8 i);
+static void queue_heap_insert(queue_heap_t* const heap, UInt8 slot);
+static void queue_heap_remove(queue_heap_t* const heap, UInt8 slot);
+static queue_heap_t* queue_send_heap(UInt8 slot);
+static BOOL queue_slot_in_use(UInt8 slot);
+#endif
+
+#ifdef EXTENDED_SINGLE
+static UInt16 single_pid_for_len(UInt16 raw_pid, UInt8 data_len);
+#endif
+
+#ifdef ON_COALESCE_QUEUE
+static BOOL coalescible(const on_single_data_queue_t* const msg);
+static BOOL coalesce_partners(const on_single_data_queue_t* const msg,
+  const on_single_data_queue_t* const other);
+static BOOL coalesce_partner_queued(const on_single_data_queue_t* const msg);
+static void coalesce_queue_elements(on_single_data_queue_t* const msg);
+#endif
+
+static UInt8 recipient_filter_bit(const on_did_unit_t* const recipient);
+
 //! @} ONE-NET_MESSAGE_pri_func
 //                      PRIVATE FUNCTION DECLARATIONS END
 //==============================================================================
@@ -109,13 +230,47 @@ static void delete_expired_queue_elements(void);
 
 
 #if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
-static UInt8 payload_buffer[SINGLE_DATA_QUEUE_PAYLOAD_BUFFER_SIZE];
+//! Payload blocks for queued messages.  The large blocks come first.
+static UInt8 payload_buffer[QUEUE_PLD_BUFFER_SIZE];
 static on_single_data_queue_t single_data_queue[SINGLE_DATA_QUEUE_SIZE];
-static UInt16 pld_buffer_tail_idx = 0;
+
+//! First free small payload block
+static UInt8 small_pld_free = QUEUE_PLD_NONE;
+
+#ifdef EXTENDED_SINGLE
+//! First free large payload block
+static UInt8 large_pld_free = QUEUE_PLD_NONE;
+#endif
+#endif
+
+#if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+//! Queue slots waiting to be sent, one heap per priority, keyed on send time.
+static queue_heap_t send_heap[QUEUE_NUM_SEND_HEAPS];
+
+#if SINGLE_QUEUE_LEVEL > MED_SINGLE_QUEUE_LEVEL
+//! Queue slots that have an expiration time, keyed on expiration time.
+static queue_heap_t expire_heap;
+#endif
+
+//! Stack of unused queue slots.  The number of entries is
+//! SINGLE_DATA_QUEUE_SIZE - single_data_queue_size.
+static UInt8 free_slot[SINGLE_DATA_QUEUE_SIZE];
+
+//! The order each slot was pushed in.  Used to keep messages with the same
+//! send time in FIFO order.
+static UInt16 queue_seq[SINGLE_DATA_QUEUE_SIZE];
+
+//! The sequence number to give to the next message pushed.
+static UInt16 next_queue_seq = 0;
 #endif
 
 UInt8 single_data_queue_size = 0;
 
+#if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
+//! Payload block usage for the single data queue
+on_queue_pld_stats_t queue_pld_stats = {0, 0, 0};
+#endif
+
 #ifdef ONE_NET_CLIENT
 extern BOOL device_is_master;
 extern BOOL client_joined_network;
@@ -1075,10 +1230,48 @@ one_net_status_t on_decrypt(UInt8 * const data,
 */
 void empty_queue(void)
 {
+    #if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
+    UInt8 i;
+    #endif
+
     single_data_queue_size = 0;
     single_msg_ptr = NULL;
     #if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
-    pld_buffer_tail_idx = 0;
+    // chain all of the payload blocks back onto their free lists
+    small_pld_free = QUEUE_PLD_NONE;
+    for(i = QUEUE_SMALL_PLD_COUNT; i > 0; i--)
+    {
+        payload_buffer[QUEUE_LARGE_PLD_BYTES + (i - 1) * QUEUE_SMALL_PLD_LEN] =
+          small_pld_free;
+        small_pld_free = i - 1;
+    }
+    
+    #ifdef EXTENDED_SINGLE
+    large_pld_free = QUEUE_PLD_NONE;
+    for(i = QUEUE_LARGE_PLD_COUNT; i > 0; i--)
+    {
+        payload_buffer[(i - 1) * QUEUE_LARGE_PLD_LEN] = large_pld_free;
+        large_pld_free = i - 1;
+    }
+    #endif
+    
+    queue_pld_stats.in_use = 0;
+    #endif
+    
+    #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+    for(i = 0; i < QUEUE_NUM_SEND_HEAPS; i++)
+    {
+        queue_heap_init(&send_heap[i], FALSE);
+    }
+    #if SINGLE_QUEUE_LEVEL > MED_SINGLE_QUEUE_LEVEL
+    queue_heap_init(&expire_heap, TRUE);
+    #endif
+    
+    // hand out the low slots first
+    for(i = 0; i < SINGLE_DATA_QUEUE_SIZE; i++)
+    {
+        free_slot[i] = SINGLE_DATA_QUEUE_SIZE - 1 - i;
+    }
     #endif
 }
 
@@ -1125,26 +1318,18 @@ on_single_data_queue_t* push_queue_element(UInt16 raw_pid,
 {
     on_single_data_queue_t* element = NULL;
     
+    #if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
+    UInt8* pld;
+    #endif
+    
     #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL    
     tick_t time_now = get_tick_count();
+    UInt8 slot;
     #endif
     
     #ifdef EXTENDED_SINGLE
     // check the pid length to make sure it's long enough
-    UInt8 pid_passed_blocks = ((raw_pid & ONE_NET_RAW_PID_SIZE_MASK) >>
-      ONE_NET_RAW_PID_SIZE_SHIFT);
-    UInt16 pid_data_len_blocks = (data_len + ONA_DATA_INDEX) /
-      ONE_NET_XTEA_BLOCK_SIZE;
-    if((data_len + ONA_DATA_INDEX) % ONE_NET_XTEA_BLOCK_SIZE)
-    {
-        pid_data_len_blocks++; // always round up if needed.
-    }
-    if(pid_passed_blocks < pid_data_len_blocks)
-    {
-        // set the number of blocks to be long enough
-        raw_pid &= ~ONE_NET_RAW_PID_SIZE_MASK;
-        raw_pid |= (pid_data_len_blocks << ONE_NET_RAW_PID_SIZE_SHIFT);
-    }
+    raw_pid = single_pid_for_len(raw_pid, data_len);
     #endif
     
     #ifdef _BLOCK_MESSAGES
@@ -1196,18 +1381,27 @@ on_single_data_queue_t* push_queue_element(UInt16 raw_pid,
     }
     #endif
     
+    if(data_len > ONA_MAX_SINGLE_PACKET_PAYLOAD_LEN)
+    {
+        return NULL; // won't fit in a single packet
+    }
+    
     #if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
     if(single_data_queue_size >= SINGLE_DATA_QUEUE_SIZE)
     {
         return NULL; // no room in queue
     }
-    if((data_len + pld_buffer_tail_idx) >
-      SINGLE_DATA_QUEUE_PAYLOAD_BUFFER_SIZE)
+    if(!(pld = queue_pld_alloc(data_len)))
     {
         return NULL; // no room in queue
     }
 
+    #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+    slot = free_slot[SINGLE_DATA_QUEUE_SIZE - single_data_queue_size - 1];
+    element = &single_data_queue[slot];
+    #else
     element = &single_data_queue[single_data_queue_size];
+    #endif
     #else
     if(single_msg_ptr || single_data_queue_size)
     {
@@ -1221,8 +1415,7 @@ on_single_data_queue_t* push_queue_element(UInt16 raw_pid,
     element->msg_type = msg_type;
     element->payload_size = data_len;
     #if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
-    element->payload = &payload_buffer[pld_buffer_tail_idx];
-    pld_buffer_tail_idx += data_len;
+    element->payload = pld;
     #else
     element->payload = single_data_raw_pld;
     #endif
@@ -1257,6 +1450,16 @@ on_single_data_queue_t* push_queue_element(UInt16 raw_pid,
     element->send_time = 0;
     element->send_time = time_now + send_time_from_now;
 
+    #endif
+    #ifdef ON_COALESCE_QUEUE
+    // if a status message this one can go out with is already waiting, give
+    // any others a chance to be queued so that they can all go in the same
+    // packet.
+    if(send_time_from_now < MS_TO_TICK(ON_COALESCE_HOLD_MS) &&
+      coalescible(element) && coalesce_partner_queued(element))
+    {
+        element->send_time = time_now + MS_TO_TICK(ON_COALESCE_HOLD_MS);
+    }
     #endif
     #if SINGLE_QUEUE_LEVEL > MED_SINGLE_QUEUE_LEVEL
     element->expire_time = 0;
@@ -1265,22 +1468,65 @@ on_single_data_queue_t* push_queue_element(UInt16 raw_pid,
 	    element->expire_time = time_now + expire_time_from_now;
     }
     #endif
+    
+    #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+    queue_seq[slot] = next_queue_seq++;
+    queue_heap_insert(queue_send_heap(slot), slot);
+    #if SINGLE_QUEUE_LEVEL > MED_SINGLE_QUEUE_LEVEL
+    if(element->expire_time)
+    {
+        queue_heap_insert(&expire_heap, slot);
+    }
+    #endif
+    #endif
     single_data_queue_size++;
     return element;
 }
 
 
 #if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
-// return true if an element was popped, false otherwise.
+// return true if an element was popped, false otherwise.  If
+// SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL, index is the queue slot
+// returned by single_data_queue_ready_to_send.
 BOOL pop_queue_element(on_single_data_queue_t* const element,
     UInt8* const buffer, UInt8 index)
 #else
 BOOL pop_queue_element(void)
 #endif
 {
-    #if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
-    UInt8 i;
-
+    #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+    if(!queue_slot_in_use(index))
+    {
+        return FALSE;
+    }
+    
+    if(element != NULL && buffer != NULL)
+    {
+        one_net_memmove(element, &single_data_queue[index],
+            sizeof(on_single_data_queue_t));
+        element->payload = buffer;
+        one_net_memmove(element->payload, single_data_queue[index].payload,
+            single_data_queue[index].payload_size);
+    }
+    
+    queue_heap_remove(queue_send_heap(index), index);
+    #if SINGLE_QUEUE_LEVEL > MED_SINGLE_QUEUE_LEVEL
+    queue_heap_remove(&expire_heap, index);
+    #endif
+    
+    queue_pld_free(single_data_queue[index].payload);
+    single_data_queue_size--;
+    free_slot[SINGLE_DATA_QUEUE_SIZE - single_data_queue_size - 1] = index;
+    
+    #ifdef ON_COALESCE_QUEUE
+    if(element != NULL && buffer != NULL)
+    {
+        coalesce_queue_elements(element);
+    }
+    #endif
+    return TRUE;
+    
+    #elif SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
     if(index >= single_data_queue_size)
     {
         // index out of range.
@@ -1299,32 +1545,9 @@ BOOL pop_queue_element(void)
     }
     
     // now delete the element
+    queue_pld_free(single_data_queue[index].payload);
     
-    // first delete the payload memory it takes in the buffer.
-    // TODO - more range checking.  Unnecessaray if the queue is doing what
-    // it's supposed to
-    if(index < single_data_queue_size - 1)
-    {
-        // we aren't popping the last element
-        UInt16 this_msg_buffer_start_idx = single_data_queue[index].payload -
-            &payload_buffer[0];
-        UInt16 next_msg_buffer_start_idx = this_msg_buffer_start_idx +
-            single_data_queue[index].payload_size;
-        UInt16 bytes_to_move = pld_buffer_tail_idx - next_msg_buffer_start_idx;
-        one_net_memmove(&payload_buffer[this_msg_buffer_start_idx],
-            &payload_buffer[next_msg_buffer_start_idx], bytes_to_move);
-            
-        // payloads have been moved.  Now adjust the payload pointers
-        for(i = index + 1; i < single_data_queue_size; i++)
-        {
-            single_data_queue[i].payload -= single_data_queue[index].payload_size;
-        }
-    }
-    
-    // adjust the tail index.
-    pld_buffer_tail_idx -= single_data_queue[index].payload_size;
-    
-    // payload(s) have been adjusted.  Now move the queue elements themselves
+    // Now move the queue elements themselves.  The payloads stay put.
     if(index < single_data_queue_size - 1)
     {
         one_net_memmove(&single_data_queue[index], &single_data_queue[index + 1],
@@ -1358,16 +1581,18 @@ BOOL pop_queue_element(void)
 	\param[out] next_sleep_time The earliest time the queue might have something to pop.
                 If the value is 0 and the function returns -1, then the queue is empty and
                 next_pop_time should be disregarded.  If the function returns a non-negative
-                value, next_pop_time should be disregarded.
+                value, next_pop_time should be disregarded.  Elements which
+                will expire before their send time are deleted.
 	
 	\return index of an element ready to be popped.  If none, -1 is returned.
+            If SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL, the index is the
+            queue slot of the element.
 */
 #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
 int single_data_queue_ready_to_send(tick_t* const next_pop_time)
 {
-	int i, j;
+    UInt8 i, slot;
     tick_t sleep_time;
-	UInt8 priority = ONE_NET_HIGH_PRIORITY;
 	tick_t cur_tick = get_tick_count();
 	*next_pop_time = 0;
         
@@ -1375,45 +1600,59 @@ int single_data_queue_ready_to_send(tick_t* const next_pop_time)
     delete_expired_queue_elements();
     #endif
     
-    if(single_data_queue_size == 0)
-    {
-        return -1; // empty queue
-    }
-	
 	// note that send_time equals 0 means send immediately
-
-	
-	// Go through the list and see if any packets are ready.  Try high priority, then low priority.
-	// Note that priority started initialized as HIGH_PRIORITY.  Go through the list twice, once for
-	// each priority.  We'll change priority at the bottom of the outer loop.  If anything is ready
-    // to pop, pop it
-	for(j = 0; j < 2; j++)
-	{
-	    for(i = 0; i < single_data_queue_size; i++)
-	    {
-            if(single_data_queue[i].priority != priority)
+    
+    // Try high priority, then low priority.  Only the top of each heap needs
+    // to be looked at.  If it is not ready, nothing else of that priority is.
+    for(i = 0; i < QUEUE_NUM_SEND_HEAPS; i++)
+    {
+        while(send_heap[i].size > 0)
+        {
+            slot = send_heap[i].slot[0];
+            
+            #if SINGLE_QUEUE_LEVEL > MED_SINGLE_QUEUE_LEVEL
+            if(single_data_queue[slot].expire_time > 0 &&
+              single_data_queue[slot].expire_time <
+              single_data_queue[slot].send_time)
             {
-                continue; // wrong priority
+                // this one will expire before it can be sent.  Get rid of it
+                // now so it doesn't hide anything behind it.
+                pop_queue_element(NULL, NULL, slot);
+                continue;
             }
+            #endif
             
-		    if(single_data_queue[i].send_time <= cur_tick)
-		    {
+            if(single_data_queue[slot].send_time <= cur_tick)
+            {
                 // we're ready to pop this element.
-                return i;
-		    }
+                return slot;
+            }
             
-            sleep_time = single_data_queue[i].send_time - cur_tick;
+            sleep_time = single_data_queue[slot].send_time - cur_tick;
             if(*next_pop_time == 0 || sleep_time < *next_pop_time)
             {
                 *next_pop_time = sleep_time;
             }
-		}
-		 
-		priority = ONE_NET_LOW_PRIORITY;
-	}
+            break;
+        }
+    }
 	
 	return -1; // nothing ready to pop.
 }
+
+
+/*!
+    \brief Gives the destination of a message in the queue
+
+    \param[in] index The queue slot of the message, as returned by
+      single_data_queue_ready_to_send
+
+    \return The destination of the message
+*/
+const on_encoded_did_t* single_data_queue_dst(UInt8 index)
+{
+    return (const on_encoded_did_t*) &(single_data_queue[index].dst_did);
+}
 #else
 int single_data_queue_ready_to_send(void)
 {
@@ -1490,9 +1729,11 @@ void clear_recipient_list(on_recipient_list_t* rec_list)
 {
     rec_list->num_recipients = 0;
     rec_list->recipient_index = -1;
+    one_net_memset(rec_list->filter, 0, sizeof(rec_list->filter));
 }
 
 
+
 /*!
     \ brief Compares two did / unit pairs and returns TRUE if they are both
       the same.
@@ -1522,7 +1763,14 @@ BOOL did_and_unit_equal(const on_did_unit_t* const dev1,
 BOOL remove_recipient_from_recipient_list(on_recipient_list_t* rec_list,
     const on_did_unit_t* const recipient_to_remove)
 {
-    UInt8 i;
+    UInt8 i, bit;
+
+    bit = recipient_filter_bit(recipient_to_remove);
+    if(!(rec_list->filter[bit / 8] & (0x80 >> (bit % 8))))
+    {
+        return FALSE; // not on the list.
+    }
+
     for(i = 0; i < rec_list->num_recipients; i++)
     {
         if(did_and_unit_equal(&(rec_list->recipient_list[i]),
@@ -1532,7 +1780,16 @@ BOOL remove_recipient_from_recipient_list(on_recipient_list_t* rec_list,
             {
                 one_net_memmove(&(rec_list->recipient_list[i]),
                   &(rec_list->recipient_list[i+1]),
-                  rec_list->num_recipients - i - 1);
+                  (rec_list->num_recipients - i - 1) * sizeof(on_did_unit_t));
+            }
+            (rec_list->num_recipients)--;
+
+            // other recipients may share the bit, so rebuild the filter.
+            one_net_memset(rec_list->filter, 0, sizeof(rec_list->filter));
+            for(i = 0; i < rec_list->num_recipients; i++)
+            {
+                bit = recipient_filter_bit(&(rec_list->recipient_list[i]));
+                rec_list->filter[bit / 8] |= (0x80 >> (bit % 8));
             }
             
             return TRUE;
@@ -1555,7 +1812,8 @@ BOOL remove_recipient_from_recipient_list(on_recipient_list_t* rec_list,
 BOOL add_recipient_to_recipient_list(on_recipient_list_t* rec_list,
     const on_did_unit_t* const recipient_to_add)
 {
-    UInt8 i;
+    UInt8 i, bit;
+    UInt8 mask;
 
     if(on_encoded_did_equal(&(recipient_to_add->did), &NO_DESTINATION))
     {
@@ -1567,12 +1825,25 @@ BOOL add_recipient_to_recipient_list(on_recipient_list_t* rec_list,
         return FALSE; // message is to us.  Don't bother sending.
     }
 
-    for(i = 0; i < rec_list->num_recipients; i++)
+    if(rec_list->num_recipients == 0)
     {
-        if(did_and_unit_equal(&(rec_list->recipient_list[i]),
-          recipient_to_add))
+        // lists can be emptied by setting num_recipients to 0, so start a
+        // new filter.
+        one_net_memset(rec_list->filter, 0, sizeof(rec_list->filter));
+    }
+
+    // only search the list if another recipient has the same filter bit.
+    bit = recipient_filter_bit(recipient_to_add);
+    mask = (0x80 >> (bit % 8));
+    if(rec_list->filter[bit / 8] & mask)
+    {
+        for(i = 0; i < rec_list->num_recipients; i++)
         {
-            return TRUE; // already on the list.
+            if(did_and_unit_equal(&(rec_list->recipient_list[i]),
+              recipient_to_add))
+            {
+                return TRUE; // already on the list.
+            }
         }
     }
 
@@ -1585,6 +1856,7 @@ BOOL add_recipient_to_recipient_list(on_recipient_list_t* rec_list,
         recipient_to_add, sizeof(on_did_unit_t));
 
     (rec_list->num_recipients)++;
+    rec_list->filter[bit / 8] |= mask;
     return TRUE;
 }
 
@@ -1659,6 +1931,21 @@ BOOL device_should_stay_awake(const on_encoded_did_t* const did)
 {
     #if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
     UInt8 i;
+    #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+    for(i = 0; i < SINGLE_DATA_QUEUE_SIZE; i++)
+    {
+        if(!queue_slot_in_use(i))
+        {
+            continue;
+        }
+        
+        if(on_encoded_did_equal((const on_encoded_did_t* const)
+          &(single_data_queue[i].dst_did), (const on_encoded_did_t* const) did))
+        {
+            return TRUE;
+        }
+    }
+    #else
     for(i = 0; i < single_data_queue_size; i++)
     {
         if(on_encoded_did_equal((const on_encoded_did_t* const)
@@ -1668,6 +1955,7 @@ BOOL device_should_stay_awake(const on_encoded_did_t* const did)
         }
     }
     #endif
+    #endif
     
     // TODO -- check everything else.  This function probably needs to be
     //         moved from one_net_message.c to one_net.c so more things
@@ -1722,6 +2010,7 @@ void admin_msg_to_block_stream_msg_t(const UInt8* msg, block_stream_msg_t*
 
     bs_msg->src = NULL;
     bs_msg->dst = NULL;
+    on_bs_set_buffer(bs_msg, NULL, 0, 0);
     if(!is_my_did((const on_encoded_did_t*) &msg[BLOCK_STREAM_SETUP_DST_IDX]))
     {
         bs_msg->dst = (*get_sender_info)((const on_encoded_did_t* const)
@@ -1876,6 +2165,95 @@ UInt32 block_get_bytes_remaining(UInt32 transfer_size, UInt32 byte_index,
     return (transfer_size < ON_BS_DATA_PLD_SIZE ? transfer_size :
       ON_BS_DATA_PLD_SIZE );
 }
+
+
+/*!
+    \brief Registers a buffer to send a transfer's data from or receive it into.
+
+    The source registers the buffer before initiating the transfer, the
+    recipient in one_net_block_stream_transfer_requested.  Packets whose data
+    is in the buffer are copied straight to or from it.  Packets outside of
+    it still go through one_net_block_get_next_payload /
+    one_net_stream_get_next_payload or the block / stream packet handlers.
+    Completed block chunks are still reported through the
+    *_block_chunk_received functions.  On host builds the buffer may be a
+    memory-mapped file.  The registration ends with the transfer.
+
+    \param[out] bs_msg The transfer
+    \param[in] buffer The buffer, or NULL to use the application's functions
+      for every packet
+    \param[in] start The byte of the transfer that buffer[0] holds.  Streams
+      use the buffer from buffer[0] on, in order, and only count from start.
+    \param[in] len The length of the buffer
+
+    \return void
+*/
+void on_bs_set_buffer(block_stream_msg_t* bs_msg, UInt8* buffer,
+  UInt32 start, UInt32 len)
+{
+    bs_msg->buffer = buffer;
+    bs_msg->buffer_start = buffer ? start : 0;
+    bs_msg->buffer_len = buffer ? len : 0;
+}
+
+
+/*!
+    \brief Finds a block packet's data in the transfer's registered buffer.
+
+    \param[in] bs_msg The block transfer
+    \param[in] byte_index The byte index of the packet's chunk
+    \param[in] chunk_index The index of the packet within its chunk
+    \param[out] len The number of data bytes in the packet
+
+    \return The packet's data in the buffer.
+            NULL if there is no buffer or the data is not all in it.
+*/
+UInt8* block_buffer_data(const block_stream_msg_t* bs_msg, UInt32 byte_index,
+  UInt8 chunk_index, UInt8* len)
+{
+    UInt32 start = (byte_index + chunk_index) * ON_BS_DATA_PLD_SIZE;
+    
+    *len = (UInt8) block_get_bytes_remaining(bs_msg->bs.block.transfer_size,
+      byte_index, chunk_index);
+    if(!bs_msg->buffer || *len == 0 || start < bs_msg->buffer_start ||
+      start - bs_msg->buffer_start + *len > bs_msg->buffer_len)
+    {
+        return NULL;
+    }
+    
+    return &(bs_msg->buffer[start - bs_msg->buffer_start]);
+}
+
+
+#ifdef STREAM_MESSAGES_ENABLED
+/*!
+    \brief Takes the next packet's worth of a stream from its registered buffer.
+
+    \param[in/out] bs_msg The stream transfer.  Its buffer moves past the
+      bytes returned.
+    \param[out] len The number of bytes returned.  Less than
+      ON_BS_DATA_PLD_SIZE only at the end of the buffer.
+
+    \return The next bytes of the buffer.
+            NULL if there is no buffer or it has been used up.
+*/
+UInt8* stream_buffer_next(block_stream_msg_t* bs_msg, UInt8* len)
+{
+    UInt8* data = bs_msg->buffer;
+    
+    if(!data || bs_msg->buffer_len == 0)
+    {
+        return NULL;
+    }
+    
+    *len = (bs_msg->buffer_len < ON_BS_DATA_PLD_SIZE) ?
+      (UInt8) bs_msg->buffer_len : ON_BS_DATA_PLD_SIZE;
+    bs_msg->buffer += *len;
+    bs_msg->buffer_start += *len;
+    bs_msg->buffer_len -= *len;
+    return data;
+}
+#endif
 #endif
 
 
@@ -1896,18 +2274,495 @@ UInt32 block_get_bytes_remaining(UInt32 transfer_size, UInt32 byte_index,
 #if SINGLE_QUEUE_LEVEL > MED_SINGLE_QUEUE_LEVEL
 static void delete_expired_queue_elements(void)
 {
-    int i;
     tick_t cur_tick = get_tick_count();
-    for(i = single_data_queue_size - 1; i >= 0 ; i--)
+    
+    // the top of the expire heap is always the next one to expire.
+    while(expire_heap.size > 0 &&
+      single_data_queue[expire_heap.slot[0]].expire_time < cur_tick)
+    {
+        pop_queue_element(NULL, NULL, expire_heap.slot[0]);
+    }
+}
+#endif    
+
+
+#if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
+/*!
+    \brief Takes a payload block for a queued message.
+    
+    \param[in] len The number of payload bytes needed.
+    
+    \return Pointer to the payload block.
+            NULL if no block that is big enough is free.
+*/
+static UInt8* queue_pld_alloc(UInt8 len)
+{
+    UInt8* pld = NULL;
+    
+    if(len <= QUEUE_SMALL_PLD_LEN && small_pld_free != QUEUE_PLD_NONE)
     {
-        if(single_data_queue[i].expire_time > 0 &&
-          single_data_queue[i].expire_time < cur_tick)
+        pld = &payload_buffer[QUEUE_LARGE_PLD_BYTES + small_pld_free *
+          QUEUE_SMALL_PLD_LEN];
+        small_pld_free = *pld;
+    }
+    #ifdef EXTENDED_SINGLE
+    else if(len <= QUEUE_LARGE_PLD_LEN && large_pld_free != QUEUE_PLD_NONE)
+    {
+        pld = &payload_buffer[large_pld_free * QUEUE_LARGE_PLD_LEN];
+        large_pld_free = *pld;
+    }
+    #endif
+    
+    if(!pld)
+    {
+        queue_pld_stats.alloc_fail++;
+        return NULL;
+    }
+    
+    queue_pld_stats.in_use++;
+    if(queue_pld_stats.in_use > queue_pld_stats.high_water)
+    {
+        queue_pld_stats.high_water = queue_pld_stats.in_use;
+    }
+    return pld;
+}
+
+
+/*!
+    \brief Returns a payload block to its free list.
+    
+    \param[in] pld The payload block, as returned by queue_pld_alloc.
+    
+    \return void
+*/
+static void queue_pld_free(UInt8* pld)
+{
+    UInt16 offset = pld - payload_buffer;
+    
+    #ifdef EXTENDED_SINGLE
+    if(offset < QUEUE_LARGE_PLD_BYTES)
+    {
+        *pld = large_pld_free;
+        large_pld_free = offset / QUEUE_LARGE_PLD_LEN;
+    }
+    else
+    #endif
+    {
+        *pld = small_pld_free;
+        small_pld_free = (offset - QUEUE_LARGE_PLD_BYTES) / QUEUE_SMALL_PLD_LEN;
+    }
+    
+    queue_pld_stats.in_use--;
+}
+#endif
+
+
+#if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+/*!
+    \brief Empties a queue heap.
+    
+    \param[out] heap The heap to initialize.
+    \param[in] by_expire_time TRUE if the heap is keyed on expire_time, FALSE
+      if it is keyed on send_time.
+    
+    \return void
+*/
+static void queue_heap_init(queue_heap_t* const heap, BOOL by_expire_time)
+{
+    heap->size = 0;
+    one_net_memset(heap->pos, QUEUE_SLOT_NOT_IN_HEAP, sizeof(heap->pos));
+    #if SINGLE_QUEUE_LEVEL > MED_SINGLE_QUEUE_LEVEL
+    heap->by_expire_time = by_expire_time;
+    #endif
+}
+
+
+/*!
+    \brief Determines whether one queue slot belongs above another in a heap.
+    
+    Slots with equal keys are ordered by when they were pushed.
+    
+    \param[in] heap The heap the slots are in.
+    \param[in] slot_a The first queue slot.
+    \param[in] slot_b The second queue slot.
+    
+    \return TRUE if slot_a belongs closer to the top than slot_b.
+*/
+static BOOL queue_heap_before(const queue_heap_t* const heap, UInt8 slot_a,
+  UInt8 slot_b)
+{
+    tick_t key_a = single_data_queue[slot_a].send_time;
+    tick_t key_b = single_data_queue[slot_b].send_time;
+    
+    #if SINGLE_QUEUE_LEVEL > MED_SINGLE_QUEUE_LEVEL
+    if(heap->by_expire_time)
+    {
+        key_a = single_data_queue[slot_a].expire_time;
+        key_b = single_data_queue[slot_b].expire_time;
+    }
+    #endif
+    
+    if(key_a != key_b)
+    {
+        return (key_a < key_b);
+    }
+    
+    // handles the sequence numbers wrapping around
+    return ((SInt16)(queue_seq[slot_a] - queue_seq[slot_b]) < 0);
+}
+
+
+static void queue_heap_swap(queue_heap_t* const heap, UInt8 i, UInt8 j)
+{
+    UInt8 temp = heap->slot[i];
+    heap->slot[i] = heap->slot[j];
+    heap->slot[j] = temp;
+    heap->pos[heap->slot[i]] = i;
+    heap->pos[heap->slot[j]] = j;
+}
+
+
+static void queue_heap_sift_up(queue_heap_t* const heap, UInt8 i)
+{
+    UInt8 parent;
+    
+    while(i > 0)
+    {
+        parent = (i - 1) / 2;
+        if(!queue_heap_before(heap, heap->slot[i], heap->slot[parent]))
         {
-            pop_queue_element(NULL, NULL, i);
+            break;
         }
+        
+        queue_heap_swap(heap, i, parent);
+        i = parent;
     }
 }
-#endif    
+
+
+static void queue_heap_sift_down(queue_heap_t* const heap, UInt8 i)
+{
+    UInt8 top;
+    UInt16 child;
+    
+    while(1)
+    {
+        top = i;
+        child = 2 * (UInt16) i + 1;
+        if(child < heap->size &&
+          queue_heap_before(heap, heap->slot[child], heap->slot[top]))
+        {
+            top = (UInt8) child;
+        }
+        
+        child++;
+        if(child < heap->size &&
+          queue_heap_before(heap, heap->slot[child], heap->slot[top]))
+        {
+            top = (UInt8) child;
+        }
+        
+        if(top == i)
+        {
+            return;
+        }
+        
+        queue_heap_swap(heap, i, top);
+        i = top;
+    }
+}
+
+
+static void queue_heap_insert(queue_heap_t* const heap, UInt8 slot)
+{
+    heap->slot[heap->size] = slot;
+    heap->pos[slot] = heap->size;
+    heap->size++;
+    queue_heap_sift_up(heap, heap->size - 1);
+}
+
+
+/*!
+    \brief Removes a queue slot from a heap.
+    
+    \param[in/out] heap The heap to remove the slot from.
+    \param[in] slot The queue slot to remove.  Nothing is done if it is not
+      in the heap.
+    
+    \return void
+*/
+static void queue_heap_remove(queue_heap_t* const heap, UInt8 slot)
+{
+    UInt8 i = heap->pos[slot];
+    
+    if(i == QUEUE_SLOT_NOT_IN_HEAP)
+    {
+        return;
+    }
+    
+    heap->pos[slot] = QUEUE_SLOT_NOT_IN_HEAP;
+    heap->size--;
+    if(i == heap->size)
+    {
+        return; // it was the last one
+    }
+    
+    // move the last one into the hole and put it where it belongs
+    heap->slot[i] = heap->slot[heap->size];
+    heap->pos[heap->slot[i]] = i;
+    queue_heap_sift_down(heap, i);
+    queue_heap_sift_up(heap, i);
+}
+
+
+/*!
+    \brief Returns the send heap a queue slot belongs in based on its priority.
+*/
+static queue_heap_t* queue_send_heap(UInt8 slot)
+{
+    if(single_data_queue[slot].priority == ONE_NET_HIGH_PRIORITY)
+    {
+        return &send_heap[QUEUE_HIGH_PRIORITY_HEAP];
+    }
+    
+    return &send_heap[QUEUE_LOW_PRIORITY_HEAP];
+}
+
+
+static BOOL queue_slot_in_use(UInt8 slot)
+{
+    if(slot >= SINGLE_DATA_QUEUE_SIZE)
+    {
+        return FALSE;
+    }
+    
+    return (queue_send_heap(slot)->pos[slot] != QUEUE_SLOT_NOT_IN_HEAP);
+}
+#endif
+
+
+#ifdef EXTENDED_SINGLE
+/*!
+    \brief Makes sure a pid is big enough for a single payload.
+    
+    \param[in] raw_pid The raw pid of the message.
+    \param[in] data_len The number of payload bytes in the message.
+    
+    \return The raw pid, with the number of blocks increased if needed.
+*/
+static UInt16 single_pid_for_len(UInt16 raw_pid, UInt8 data_len)
+{
+    UInt8 pid_passed_blocks = ((raw_pid & ONE_NET_RAW_PID_SIZE_MASK) >>
+      ONE_NET_RAW_PID_SIZE_SHIFT);
+    UInt16 pid_data_len_blocks = (data_len + ONA_DATA_INDEX) /
+      ONE_NET_XTEA_BLOCK_SIZE;
+    if((data_len + ONA_DATA_INDEX) % ONE_NET_XTEA_BLOCK_SIZE)
+    {
+        pid_data_len_blocks++; // always round up if needed.
+    }
+    if(pid_passed_blocks < pid_data_len_blocks)
+    {
+        // set the number of blocks to be long enough
+        raw_pid &= ~ONE_NET_RAW_PID_SIZE_MASK;
+        raw_pid |= (pid_data_len_blocks << ONE_NET_RAW_PID_SIZE_SHIFT);
+    }
+    return raw_pid;
+}
+#endif
+
+
+#ifdef ON_COALESCE_QUEUE
+/*!
+    \brief Determines whether a message may be sent as part of an
+           ON_COALESCED_APP_MSG.
+    
+    Only single status messages qualify.  Nothing in the ACK of a status
+    message is needed by the sender, so one ACK can stand for all of them.
+    The destination must be able to receive extended single packets.
+    
+    \param[in] msg The message.
+    
+    \return TRUE if the message can be sent along with others.
+*/
+static BOOL coalescible(const on_single_data_queue_t* const msg)
+{
+    on_sending_device_t* device;
+    
+    if(msg->msg_type != ON_APP_MSG ||
+      msg->payload_size != ONA_SINGLE_PACKET_PAYLOAD_LEN ||
+      (msg->raw_pid & ONE_NET_RAW_PID_PACKET_TYPE_MASK) !=
+      ONE_NET_RAW_SINGLE_DATA ||
+      !ONA_IS_STATUS_MESSAGE(get_msg_class(msg->payload)))
+    {
+        return FALSE;
+    }
+    
+    #ifdef PEER
+    if(msg->send_to_peer_list)
+    {
+        return FALSE;
+    }
+    #endif
+    
+    #ifdef ONE_NET_CLIENT
+    if(must_send_to_master(msg))
+    {
+        return FALSE;
+    }
+    #endif
+    
+    device = (*get_sender_info)((const on_encoded_did_t*) &(msg->dst_did));
+    return (device && features_extended_single_capable(device->features));
+}
+
+
+/*!
+    \brief Determines whether two messages can be sent in the same
+           ON_COALESCED_APP_MSG.
+    
+    \param[in] msg A message that can be coalesced.
+    \param[in] other The message to check against it.
+    
+    \return TRUE if other has the same source, destination, priority, and pid
+            flags as msg and can be coalesced.
+*/
+static BOOL coalesce_partners(const on_single_data_queue_t* const msg,
+  const on_single_data_queue_t* const other)
+{
+    return (other->priority == msg->priority &&
+      !((other->raw_pid ^ msg->raw_pid) & ~ONE_NET_RAW_PID_SIZE_MASK) &&
+      on_encoded_did_equal((const on_encoded_did_t* const) &(other->dst_did),
+      (const on_encoded_did_t* const) &(msg->dst_did)) &&
+      on_encoded_did_equal((const on_encoded_did_t* const) &(other->src_did),
+      (const on_encoded_did_t* const) &(msg->src_did)) &&
+      coalescible(other));
+}
+
+
+/*!
+    \brief Determines whether a message that could go along with a new one is
+           already in the queue.
+    
+    \param[in] msg The new message.  It must not be in the queue yet.
+    
+    \return TRUE if a queued message can be sent with msg.
+*/
+static BOOL coalesce_partner_queued(const on_single_data_queue_t* const msg)
+{
+    UInt8 i;
+    
+    for(i = 0; i < SINGLE_DATA_QUEUE_SIZE; i++)
+    {
+        if(queue_slot_in_use(i) &&
+          coalesce_partners(msg, &single_data_queue[i]))
+        {
+            return TRUE;
+        }
+    }
+    
+    return FALSE;
+}
+
+
+/*!
+    \brief Moves queued messages that can go along with a popped message
+           into its payload.
+    
+    Messages are taken oldest first if they have the same source,
+    destination, priority, and pid flags and are due to be sent within
+    ON_COALESCE_HOLD_MS.  If any are found, the popped message becomes an
+    ON_COALESCED_APP_MSG holding the count followed by each ON_APP_MSG
+    payload in the order they were queued.
+    
+    \param[in/out] msg The message that was just popped.  Its payload must
+      have room for ONA_MAX_SINGLE_PACKET_PAYLOAD_LEN bytes.
+    
+    \return void
+*/
+static void coalesce_queue_elements(on_single_data_queue_t* const msg)
+{
+    UInt8 i, slot;
+    UInt8 num_msgs = 1;
+    tick_t hold_end;
+    const on_single_data_queue_t* other;
+    
+    if(!coalescible(msg))
+    {
+        return;
+    }
+    
+    hold_end = get_tick_count() + MS_TO_TICK(ON_COALESCE_HOLD_MS);
+    while(num_msgs < ON_MAX_COALESCED_MSGS)
+    {
+        slot = QUEUE_SLOT_NOT_IN_HEAP;
+        for(i = 0; i < SINGLE_DATA_QUEUE_SIZE; i++)
+        {
+            if(!queue_slot_in_use(i))
+            {
+                continue;
+            }
+            
+            other = &single_data_queue[i];
+            
+            // handles the tick count wrapping around
+            if((SInt32)(other->send_time - hold_end) > 0 ||
+              !coalesce_partners(msg, other))
+            {
+                continue;
+            }
+            
+            if(slot == QUEUE_SLOT_NOT_IN_HEAP ||
+              (SInt16)(queue_seq[i] - queue_seq[slot]) < 0)
+            {
+                slot = i;
+            }
+        }
+        
+        if(slot == QUEUE_SLOT_NOT_IN_HEAP)
+        {
+            break;
+        }
+        
+        if(num_msgs == 1)
+        {
+            // make room for the count
+            one_net_memmove(&(msg->payload[ON_COALESCED_MSG_IDX]),
+              msg->payload, ONA_SINGLE_PACKET_PAYLOAD_LEN);
+        }
+        
+        one_net_memmove(&(msg->payload[ON_COALESCED_MSG_IDX + num_msgs *
+          ONA_SINGLE_PACKET_PAYLOAD_LEN]), single_data_queue[slot].payload,
+          ONA_SINGLE_PACKET_PAYLOAD_LEN);
+        num_msgs++;
+        pop_queue_element(NULL, NULL, slot);
+    }
+    
+    if(num_msgs == 1)
+    {
+        return;
+    }
+    
+    msg->msg_type = ON_COALESCED_APP_MSG;
+    msg->payload[ON_COALESCED_COUNT_IDX] = num_msgs;
+    msg->payload_size = ON_COALESCED_MSG_IDX + num_msgs *
+      ONA_SINGLE_PACKET_PAYLOAD_LEN;
+    msg->raw_pid = single_pid_for_len(msg->raw_pid, msg->payload_size);
+}
+#endif
+
+
+/*!
+    \brief Returns the bit in a recipient list filter for a did / unit pair.
+
+    \param[in] recipient The did / unit pair.
+
+    \return The filter bit, 0 to ON_RECIPIENT_FILTER_BITS - 1.
+*/
+static UInt8 recipient_filter_bit(const on_did_unit_t* const recipient)
+{
+    return (UInt8)(recipient->did[0] * 31 + recipient->did[1] +
+      recipient->unit * 7) & (ON_RECIPIENT_FILTER_BITS - 1);
+}
 
 
 //! @} ONE-NET_MESSAGE_pri_func
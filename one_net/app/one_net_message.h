@@ -63,6 +63,11 @@
 extern const on_encoded_did_t NO_DESTINATION;
 
 
+//! Number of bits in the membership filter of a recipient list.  Must be a
+//! power of 2.
+#define ON_RECIPIENT_FILTER_BITS 32
+
+
 //! @} ONE-NET_MESSAGE_const
 //                                  CONSTANTS END
 //==============================================================================
@@ -92,7 +97,7 @@ typedef enum
     ON_FEATURE_MSG,                 //!< A request for features
     ON_ROUTE_MSG,                   //!< A routing message
     
-    ON_RESERVED_MSG_TYPE_1,              //!< Unspecified, but reserved for future use
+    ON_COALESCED_APP_MSG,           //!< Several ON_APP_MSG payloads sent in one extended single packet (count, then each payload)
     ON_RESERVED_MSG_TYPE_2,              //!< Unspecified, but reserved for future use
     ON_RESERVED_MSG_TYPE_3,              //!< Unspecified, but reserved for future use
     
@@ -165,17 +170,54 @@ typedef struct
     UInt16 msg_id;                  //!< The message id of the current or next transaction with this device(0 - 4095).
     tick_t verify_time;             //!< The last time the message id was verified for this device
 } on_sending_device_t; 
+
+
+/*!
+    \brief Info for communicating with a device that is kept in RAM only.
+
+    on_sending_device_t is saved with the other non-volatile parameters, so
+    anything that is learned at run time and should not change their layout
+    goes here instead.  See get_sender_ram.
+*/
+typedef struct
+{
+    UInt16 srtt;                    //!< Smoothed time, in ms per hop, this device takes to respond.  0 if not timed yet.
+    UInt16 rttvar;                  //!< Mean deviation of the response time, in ms per hop.
+    #ifdef ON_MSG_ID_WINDOW
+    UInt16 rx_msg_id_top;           //!< The highest message id received from this device
+    UInt32 rx_msg_id_window;        //!< Bit n is set if message id rx_msg_id_top - n has been received.  0 if none have.
+    #endif
+} on_sending_device_ram_t;
+
+
+#ifndef ONE_NET_SIMPLE_CLIENT
+//! Marks the end of the sending device list's lru and free lists, and an
+//! empty slot in its hash table
+#define ON_SENDING_DEV_NONE 0xFF
+#endif
 
 
 typedef struct
 {
     on_sending_device_t sender;     //!< did, etc. from sender.
     #ifndef ONE_NET_SIMPLE_CLIENT
-    UInt8 lru;                      //!< least recently used value
+    UInt8 lru_newer;                //!< Index of the next more recently used device.  ON_SENDING_DEV_NONE if none.
+    UInt8 lru_older;                //!< Index of the next less recently used device, or of the next free slot if this one is free.  ON_SENDING_DEV_NONE if none.
     device_slideoff_t slideoff;    //!< Whether the device can "slide off" the list when the list gets full.
     #endif
 } on_sending_dev_list_item_t;
 
+
+#ifndef ONE_NET_SIMPLE_CLIENT
+//! Counters for the sending device list
+typedef struct
+{
+    UInt16 hits;      //!< lookups that found the device on the list
+    UInt16 misses;    //!< lookups that had to add the device
+    UInt16 evictions; //!< devices that slid off to make room for another
+} on_sending_dev_stats_t;
+#endif
+
 
 //! Transaction structure
 typedef struct
@@ -470,6 +512,15 @@ typedef struct
 } on_single_data_queue_t;
 
 
+//!< Usage counters for the single message queue payload blocks.
+typedef struct
+{
+    UInt8 in_use;       //!< number of payload blocks currently allocated
+    UInt8 high_water;   //!< most payload blocks ever allocated at once
+    UInt16 alloc_fail;  //!< pushes refused because no payload block was free
+} on_queue_pld_stats_t;
+
+
 //! Combining three common elements of a message to save stack space when
 //! calling functions.
 typedef struct
@@ -510,6 +561,12 @@ typedef struct
     //! recipient list either has not started, has finished, or is not
     //! relevant
     SInt8 recipient_index;
+
+    //! One bit per did / unit hash.  A clear bit means no recipient on the
+    //! list has that hash, so most additions need no search of the list.
+    //! Kept by add_recipient_to_recipient_list and
+    //! remove_recipient_from_recipient_list.
+    UInt8 filter[ON_RECIPIENT_FILTER_BITS / 8];
 } on_recipient_list_t;
 
 
@@ -646,6 +703,13 @@ typedef struct
            // bitwise "boolean" array, with each bit representing whether a
            // certain packet within a chunk has been received.  0 means FALSE.
            // 1 means TRUE.
+    // The sender adapts chunk_size, frag_dly, and chunk_pause to the losses
+    // it sees.  These are the values agreed on at setup and the losses in
+    // the chunk being sent.
+    UInt8 max_chunk_size; // chunk_size never grows past this
+    UInt8 chunk_losses; // packets of the current chunk that did not arrive
+    UInt16 base_frag_dly;
+    UInt16 base_chunk_pause;
 } block_msg_t;
 
 
@@ -683,6 +747,14 @@ typedef struct
     BOOL use_saved_ack_nack;
     UInt8 saved_ack_nack_payload_bytes[5];
     on_ack_nack_t saved_ack_nack;
+    // If buffer is not NULL, ONE-NET reads the data to send from it or
+    // writes the data received to it instead of going through the
+    // application's per-packet functions.  buffer[0] is byte buffer_start of
+    // the transfer.  Set with on_bs_set_buffer.  Streams use the buffer in
+    // order, so buffer, buffer_start, and buffer_len move as it is used.
+    UInt8* buffer;
+    UInt32 buffer_start;
+    UInt32 buffer_len;
 } block_stream_msg_t;
 
 
@@ -729,6 +801,10 @@ typedef union
 
 extern UInt8 single_data_queue_size;
 
+#if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
+extern on_queue_pld_stats_t queue_pld_stats;
+#endif
+
 
 //! The list of recipients to send to for THIS message
 extern on_recipient_list_t recipient_send_list;
@@ -858,6 +934,7 @@ BOOL pop_queue_element(void);
 
 #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
 int single_data_queue_ready_to_send(tick_t* const queue_sleep_time);
+const on_encoded_did_t* single_data_queue_dst(UInt8 index);
 #else
 int single_data_queue_ready_to_send(void);
 #endif
@@ -963,6 +1040,14 @@ UInt32 block_get_bytes_remaining(UInt32 transfer_size, UInt32 byte_index,
 // returns the chunk size to be used. For the first and last 40 packets,
 // the chunk size is 1.  Otherwise it is whatever is stored in the message
 UInt8 get_current_bs_chunk_size(const block_stream_msg_t* bs_msg);
+
+void on_bs_set_buffer(block_stream_msg_t* bs_msg, UInt8* buffer,
+  UInt32 start, UInt32 len);
+UInt8* block_buffer_data(const block_stream_msg_t* bs_msg, UInt32 byte_index,
+  UInt8 chunk_index, UInt8* len);
+#ifdef STREAM_MESSAGES_ENABLED
+UInt8* stream_buffer_next(block_stream_msg_t* bs_msg, UInt8* len);
+#endif
 #endif
 
 
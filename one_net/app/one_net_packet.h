@@ -907,6 +907,21 @@ enum
 };
 
 
+#ifdef EXTENDED_SINGLE
+//! constants dealing with the raw payload of an ON_COALESCED_APP_MSG
+enum
+{
+    ON_COALESCED_COUNT_IDX = 0, //! the number of ON_APP_MSG payloads
+    ON_COALESCED_MSG_IDX = 1,   //! the index where the first ON_APP_MSG
+                                //! payload starts.  The rest follow it.
+    
+    //! the most ON_APP_MSG payloads that fit in one extended single
+    ON_MAX_COALESCED_MSGS = (ONA_MAX_SINGLE_PACKET_PAYLOAD_LEN -
+      ON_COALESCED_MSG_IDX) / ONA_SINGLE_PACKET_PAYLOAD_LEN
+};
+#endif
+
+
 //! Invite related constants
 enum
 {
@@ -955,6 +970,13 @@ typedef struct
     UInt8 hops; //! hops of the packet.  May or may not be relevant.
     UInt8 max_hops; //! Maximum hops of the packet.  May or may not be relevant
     #endif
+    
+    // The header addresses, decoded once when a packet is received so that
+    // the handlers need not decode them again.  Not filled in for packets
+    // this device builds.
+    on_raw_did_t raw_src_did; //! raw DID of the source
+    on_raw_did_t raw_dst_did; //! raw DID of the destination
+    on_raw_did_t raw_rptr_did; //! raw DID of the last device to send it
 } on_pkt_t;
 
 
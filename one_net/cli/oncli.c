@@ -145,6 +145,9 @@ BOOL command_processed = FALSE;
 #ifdef ONE_NET_CLIENT
 extern on_master_t* const master;
 extern on_sending_dev_list_item_t sending_dev_list[];
+#ifndef ONE_NET_SIMPLE_CLIENT
+extern on_sending_dev_stats_t sending_dev_stats;
+#endif
 #endif
 #ifdef ONE_NET_MASTER
 extern on_client_t * const client_list;
@@ -1030,11 +1033,19 @@ void print_client_send_list(void)
     for(i = 0; i < ONE_NET_RX_FROM_DEVICE_COUNT; i++)
     {
         oncli_send_msg("Send List %d:", i);
-        oncli_send_msg("LRU(%d) PSO(%d):", sending_dev_list[i].lru,
+        #ifndef ONE_NET_SIMPLE_CLIENT
+        oncli_send_msg("Newer(%d) Older(%d) PSO(%d):",
+          sending_dev_list[i].lru_newer, sending_dev_list[i].lru_older,
           sending_dev_list[i].slideoff);
+        #endif
         print_sending_device_t(&(sending_dev_list[i].sender));
         delay_ms(10);
     }
+    #ifndef ONE_NET_SIMPLE_CLIENT
+    oncli_send_msg("Send List: %u hits, %u misses, %u evictions\n",
+      sending_dev_stats.hits, sending_dev_stats.misses,
+      sending_dev_stats.evictions);
+    #endif
 }
 #endif
 
@@ -1056,6 +1067,7 @@ void print_master_send_list(void)
 void print_sending_device_t(const on_sending_device_t* const device)
 {
     on_raw_did_t raw_did;
+    const on_sending_device_ram_t* ram = (*get_sender_ram)(device);
     oncli_send_msg("Enc. DID=0x%02X%02X, Raw DID=", device->did[0],
         device->did[1]);
     if(on_decode(raw_did, device->did, ON_ENCODED_DID_LEN) == ONS_SUCCESS)
@@ -1073,6 +1085,12 @@ void print_sending_device_t(const on_sending_device_t* const device)
     
     oncli_send_msg(", Data Rate=%d", device->data_rate);
     oncli_send_msg(", Msg ID=%d", device->msg_id);
+    if(ram)
+    {
+        oncli_send_msg(", SRTT=%u ms, RTT Var.=%u ms", ram->srtt, ram->rttvar);
+    }
+    oncli_send_msg(", Resp. Timeout=%u ms",
+      one_net_device_response_timeout(device));
     oncli_send_msg(", Cur. Time=%ld ms, Verify Time=%ld ms\n",
       MS_TO_TICK(get_tick_count()), MS_TO_TICK(device->verify_time));
 }
@@ -81,6 +81,9 @@
 
 #ifdef DEBUGGING_TOOLS
 #include "one_net_timer.h"
+#ifdef ONE_NET_MEMORY
+#include "one_net_memory.h"
+#endif
 #ifdef ONE_NET_CLIENT
 #include "one_net_client_port_const.h"
 #endif
@@ -388,6 +391,9 @@ static int parse_memory_str(UInt8** mem_ptr,
 static oncli_status_t csdf_cmd_hdlr(const char * const ASCII_PARAM_LIST);
 static oncli_status_t memory_cmd_hdlr(
   const char * const ASCII_PARAM_LIST);
+#ifdef ONE_NET_MEMORY
+static void print_heap_stats(void);
+#endif
 static oncli_status_t memdump_cmd_hdlr(void);
 static oncli_status_t memset_cmd_hdlr(
   const char * const ASCII_PARAM_LIST);
@@ -415,6 +421,11 @@ static oncli_status_t verbose_level_cmd_hdlr(
 static oncli_status_t route_cmd_hdlr(const char * const ASCII_PARAM_LIST);
 #endif
 
+#ifdef ON_STATS
+static oncli_status_t stats_cmd_hdlr(void);
+static oncli_status_t stats_reset_cmd_hdlr(void);
+#endif
+
 
 
 
@@ -1140,6 +1151,33 @@ oncli_status_t oncli_parse_cmd(const char * const CMD, const char ** CMD_STR,
     } // else if the route command was received //
     #endif
 
+    #ifdef ON_STATS
+    if(!strncmp(ONCLI_STATS_RESET_CMD_STR, CMD,
+      strlen(ONCLI_STATS_RESET_CMD_STR)))
+    {
+        *CMD_STR = ONCLI_STATS_RESET_CMD_STR;
+
+        if(CMD[strlen(ONCLI_STATS_RESET_CMD_STR)] != '\n')
+        {
+            return ONCLI_PARSE_ERR;
+        } // if the end the command is not valid //
+
+        return stats_reset_cmd_hdlr();
+    } // else if the stats reset command was received //
+
+    if(!strncmp(ONCLI_STATS_CMD_STR, CMD, strlen(ONCLI_STATS_CMD_STR)))
+    {
+        *CMD_STR = ONCLI_STATS_CMD_STR;
+
+        if(CMD[strlen(ONCLI_STATS_CMD_STR)] != '\n')
+        {
+            return ONCLI_PARSE_ERR;
+        } // if the end the command is not valid //
+
+        return stats_cmd_hdlr();
+    } // else if the stats command was received //
+    #endif
+
     else
     {
         *CMD_STR = CMD;
@@ -1391,9 +1429,19 @@ static oncli_status_t list_cmd_hdlr(void)
         if(!device_is_master)
         {
             #ifdef ONE_NET_CLIENT
+            on_sending_device_ram_t* sender_ram =
+              (*get_sender_ram)(&(master->device));
+            
             flags = master->flags;
             oncli_send_msg("Keep-Alive Interval:%ld ms\n",
               master->keep_alive_interval);
+            if(sender_ram)
+            {
+                oncli_send_msg("Resp. Time:%u ms (+/- %u ms), ",
+                  sender_ram->srtt, sender_ram->rttvar);
+            }
+            oncli_send_msg("Timeout:%u ms\n",
+              one_net_device_response_timeout(&(master->device)));
             oncli_send_msg("Send To Master: %s\n", flags &
               ON_SEND_TO_MASTER ? TRUE_STR : FALSE_STR);
             oncli_send_msg("Reject Bad Msg ID: %s\n", flags &
@@ -1460,8 +1508,18 @@ static oncli_status_t list_cmd_hdlr(void)
             #if DEBUG_VERBOSE_LEVEL > 3
             if(verbose_level > 3)
             {
+                on_sending_device_ram_t* sender_ram =
+                  (*get_sender_ram)(&(client->device));
+                
                 oncli_send_msg("Keep-Alive Interval:%ld ms\n",
                   client->keep_alive_interval);
+                if(sender_ram)
+                {
+                    oncli_send_msg("Resp. Time:%u ms (+/- %u ms), ",
+                      sender_ram->srtt, sender_ram->rttvar);
+                }
+                oncli_send_msg("Timeout:%u ms\n",
+                  one_net_device_response_timeout(&(client->device)));
                 oncli_send_msg("Send To Master: %s\n",
                   client->flags & ON_SEND_TO_MASTER ? TRUE_STR : FALSE_STR);
                 oncli_send_msg("Reject Bad Msg ID: %s\n",
@@ -3787,6 +3845,68 @@ static oncli_status_t route_cmd_hdlr(const char * const ASCII_PARAM_LIST)
 #endif
 
 
+#ifdef ON_STATS
+/*!
+    \brief Displays the ONE-NET state machine counters.
+
+    Only the statuses and packet types that have been seen are listed.  The
+    last status line counts application defined statuses.
+
+    \return ONCLI_SUCCESS
+*/
+static oncli_status_t stats_cmd_hdlr(void)
+{
+    UInt8 i;
+    
+    oncli_send_msg("State : Entries : ms\n");
+    for(i = 0; i < on_stats.num_states; i++)
+    {
+        oncli_send_msg("%02X : %u : %lu\n", on_stats.state[i].state,
+          on_stats.state[i].entries, TICK_TO_MS(on_stats.state[i].ticks));
+    }
+    oncli_send_msg("Untracked state entries : %u\n",
+      on_stats.untracked_entries);
+    delay_ms(10);
+    
+    for(i = 0; i <= ON_NUM_MESSAGE_STATUS_CODES; i++)
+    {
+        if(on_stats.status[i])
+        {
+            oncli_send_msg("Status %02X : %u\n", i, on_stats.status[i]);
+        }
+    }
+    
+    oncli_send_msg("Channel busy : %u\n", on_stats.channel_busy);
+    oncli_send_msg("Retries : %u\n", on_stats.retries);
+    delay_ms(10);
+    
+    oncli_send_msg("PID : Sent : Received\n");
+    for(i = 0; i < ON_STATS_NUM_PIDS; i++)
+    {
+        if(on_stats.tx_pid[i] || on_stats.rx_pid[i])
+        {
+            oncli_send_msg("%02X : %u : %u\n", i, on_stats.tx_pid[i],
+              on_stats.rx_pid[i]);
+        }
+    }
+    
+    return ONCLI_SUCCESS;
+} // stats_cmd_hdlr //
+
+
+/*!
+    \brief Clears the ONE-NET state machine counters.
+
+    \return ONCLI_SUCCESS
+*/
+static oncli_status_t stats_reset_cmd_hdlr(void)
+{
+    on_stats_reset();
+    return ONCLI_SUCCESS;
+} // stats_reset_cmd_hdlr //
+#endif
+
+
 #ifdef DEBUGGING_TOOLS
 /*!
     \brief Loads memory into the stored memory location.
@@ -4210,7 +4330,17 @@ static oncli_status_t csdf_cmd_hdlr(const char * const ASCII_PARAM_LIST)
 static oncli_status_t memory_cmd_hdlr(const char * const ASCII_PARAM_LIST)
 {
     UInt8* mem_ptr;
-    int len = parse_memory_str(&mem_ptr, ASCII_PARAM_LIST);
+    int len;
+    
+    #ifdef ONE_NET_MEMORY
+    if(ASCII_PARAM_LIST && !strcmp(ASCII_PARAM_LIST, "heap\n"))
+    {
+        print_heap_stats();
+        return ONCLI_SUCCESS;
+    }
+    #endif
+    
+    len = parse_memory_str(&mem_ptr, ASCII_PARAM_LIST);
     if(len < 1)
     {
         return ONCLI_PARSE_ERR;
@@ -4223,6 +4353,38 @@ static oncli_status_t memory_cmd_hdlr(const char * const ASCII_PARAM_LIST)
 }
 
 
+#ifdef ONE_NET_MEMORY
+/*!
+    \brief Prints the one_net_malloc heap statistics ("memory:heap").
+
+    Internal fragmentation is the share of the held block bytes that the
+    callers did not ask for.
+
+    \return void
+*/
+static void print_heap_stats(void)
+{
+    UInt8 cls;
+    UInt16 in_use = one_net_heap_stats.bytes_in_use;
+
+    for(cls = 0; cls < ONE_NET_HEAP_NUM_CLASSES; cls++)
+    {
+        oncli_send_msg("Class %d (%d bytes) : %d of %d in use, peak %d\n",
+          cls, one_net_heap_block_size(cls),
+          one_net_heap_stats.blocks_in_use[cls], one_net_heap_block_count(cls),
+          one_net_heap_stats.peak_blocks_in_use[cls]);
+    }
+
+    oncli_send_msg("Bytes in use = %u (peak %u) : requested = %u : "
+      "internal frag = %u%%\n", in_use, one_net_heap_stats.peak_bytes_in_use,
+      one_net_heap_stats.bytes_requested, in_use ? (UInt16)(((UInt32)(in_use -
+      one_net_heap_stats.bytes_requested) * 100) / in_use) : 0);
+    oncli_send_msg("Alloc failures = %u : with enough bytes free = %u\n",
+      one_net_heap_stats.alloc_fail, one_net_heap_stats.frag_fail);
+}
+#endif
+
+
 
 
 static oncli_status_t pause_cmd_hdlr(void)
@@ -588,6 +588,11 @@ const char* const ONCLI_VERBOSE_LEVEL_CMD_STR = "verbose level";
 const char* const ONCLI_ROUTE_CMD_STR = "route";
 #endif
 
+#ifdef ON_STATS
+const char* const ONCLI_STATS_RESET_CMD_STR = "stats reset";
+const char* const ONCLI_STATS_CMD_STR = "stats";
+#endif
+
 const char* const EMPTY_STRING = "";
 
   
@@ -375,6 +375,11 @@ extern const char* const ONCLI_VERBOSE_LEVEL_CMD_STR;
 extern const char* const ONCLI_ROUTE_CMD_STR;
 #endif
 
+#ifdef ON_STATS
+extern const char* const ONCLI_STATS_RESET_CMD_STR;
+extern const char* const ONCLI_STATS_CMD_STR;
+#endif
+
 extern const char* const EMPTY_STRING;
 
 
@@ -86,6 +86,100 @@ const on_raw_did_t ON_RAW_BROADCAST_DID = {0x00, 0x00};
 const on_raw_did_t MASTER_RAW_DID = {0x00, 0x10};
 const on_encoded_did_t MASTER_ENCODED_DID = {0xB4, 0xBC};
 
+//! Shortest response timeout, in ms per hop, derived from a device's timed
+//! responses
+#define ON_MIN_RESPONSE_TIME_OUT 10
+
+//! The longest response timeout, as a multiple of one_net_response_time_out.
+//! Bounds both the timeout derived from a device's responses and the
+//! doubling after each try that times out.
+#define ON_MAX_RESPONSE_TIME_OUT_FACTOR 4
+
+#ifdef ONE_NET_MULTI_HOP
+//! Number of destinations whose route is remembered
+#ifndef ON_ROUTE_CACHE_SIZE
+#define ON_ROUTE_CACHE_SIZE 4
+#endif
+
+//! How long, in ms, a route is used after it was last seen working
+#define ON_ROUTE_CACHE_TIMEOUT_MS 300000
+#endif
+
+#ifdef BLOCK_MESSAGES_ENABLED
+//! The sender of a block transfer keeps the fragment delay and chunk pause
+//! between the agreed values divided and multiplied by this.
+#define ON_BS_ADAPT_RANGE 4
+
+//! The fragment delay, in ms, taken off after each chunk that arrives whole
+#define ON_BS_FRAG_DLY_STEP_MS 2
+
+//! The chunk pause, in ms, taken off after each chunk that arrives whole
+#define ON_BS_CHUNK_PAUSE_STEP_MS 10
+
+#if ON_BS_MAX_SESSIONS > 1
+//! Number of timers saved with a parked block / stream transfer
+#define ON_BS_SESSION_NUM_TIMERS 2
+#endif
+#endif
+
+#if ON_SINGLE_TXN_WINDOW > 1 && SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL && !defined(ONE_NET_SIMPLE_CLIENT)
+//! Single transactions that got no response wait for their retry off the
+//! air so that messages to other devices can go in the meantime.
+#define ON_PARK_SINGLE_TXNS
+#endif
+
+#ifdef ONE_NET_MH_CLIENT_REPEATER
+//! Number of recently repeated packets remembered so that copies of them
+//! arriving over other paths are not repeated again
+#ifndef ON_MH_DUP_CACHE_SIZE
+#define ON_MH_DUP_CACHE_SIZE 8
+#endif
+#endif
+
+#ifdef ON_MSG_ID_WINDOW
+//! Number of message ids, counting back from the highest one received from
+//! a device, that are remembered in the device's replay window.
+#define ON_MSG_ID_WINDOW_SIZE 32
+#endif
+
+#ifdef ON_STATS
+//! Marks stats_state as not being any state
+#define ON_STATS_NO_STATE 0xFF
+
+//! Counts a status returned by a packet handler
+#define ON_STATS_STATUS(msg_status) on_stats.status[(msg_status) < \
+  ON_NUM_MESSAGE_STATUS_CODES ? (msg_status) : ON_NUM_MESSAGE_STATUS_CODES]++
+
+//! Counts a packet sent or received
+#define ON_STATS_PID(counts, raw_pid) do \
+  { \
+      if(((raw_pid) & ONE_NET_RAW_PID_PACKET_TYPE_MASK) < ON_STATS_NUM_PIDS) \
+      { \
+          (counts)[(raw_pid) & ONE_NET_RAW_PID_PACKET_TYPE_MASK]++; \
+      } \
+  } while(0)
+#else
+#define ON_STATS_STATUS(msg_status)
+#define ON_STATS_PID(counts, raw_pid)
+#endif
+
+//! An encoded DID as one 16-bit word so that DIDs compare in one step
+#define ON_DID_WORD(did) ((((UInt16) (did)[0]) << 8) | (did)[1])
+
+//! What the addresses in a received packet's header are.  See
+//! classify_rx_addresses.
+enum
+{
+    ON_RX_DST_ME = 0x01,
+    ON_RX_DST_BROADCAST = 0x02,
+    ON_RX_DST_MASTER = 0x04,
+    ON_RX_DST_BS_ENDPOINT = 0x08,
+    ON_RX_SRC_ME = 0x10,
+    ON_RX_SRC_MASTER = 0x20,
+    ON_RX_SRC_EXPECTED = 0x40,
+    ON_RX_SRC_BS_ENDPOINT = 0x80
+};
+
 //! @} ONE-NET_const
 //                                  CONSTANTS END
 //==============================================================================
@@ -96,6 +190,108 @@ const on_encoded_did_t MASTER_ENCODED_DID = {0xB4, 0xBC};
 //! \ingroup ONE-NET
 //! @{
 
+#ifdef ONE_NET_MULTI_HOP
+/*!
+    \brief A route that was seen to work to a destination
+*/
+typedef struct
+{
+    //! The destination.  The broadcast DID if the entry is not in use.
+    on_encoded_did_t did;
+
+    //! The hops needed to get there and back (whichever is more)
+    UInt8 hops;
+
+    //! The repeaters, far to near, or ON_ROUTE_REPEATERS_UNKNOWN if only
+    //! the hop count is known.
+    UInt8 num_repeaters;
+
+    //! The repeaters, ordered as extract_repeaters_and_hops_from_route
+    //! orders them.
+    on_encoded_did_t repeaters[ON_MAX_HOPS_LIMIT];
+
+    //! The last time the route was seen working
+    tick_t seen_time;
+} on_route_cache_entry_t;
+#endif
+
+#if defined(BLOCK_MESSAGES_ENABLED) && ON_BS_MAX_SESSIONS > 1
+/*!
+    \brief A block / stream transfer waiting for its turn
+*/
+typedef struct
+{
+    //! The transfer.  Not in use if transfer_in_progress is FALSE.
+    block_stream_msg_t msg;
+
+    //! When the timers in bs_session_timers expire.  Kept as times rather
+    //! than durations so they run down while the transfer is parked.
+    tick_t timer_expire[ON_BS_SESSION_NUM_TIMERS];
+
+    //! Bit i is set if timer i of bs_session_timers was running.
+    UInt8 timers_active;
+
+    //! When the transfer was parked.  The one parked longest goes next.
+    tick_t parked_time;
+} on_bs_session_t;
+#endif
+
+#ifdef ON_PARK_SINGLE_TXNS
+/*!
+    \brief A single transaction waiting to retry
+*/
+typedef struct
+{
+    //! The transaction.  Not in use if its priority is ONE_NET_NO_PRIORITY.
+    on_txn_t txn;
+
+    //! The device the transaction is to.  If txn.device no longer has this
+    //! DID when the transaction resumes, the device is looked up again.
+    on_encoded_did_t did;
+
+    //! The message being sent.  Its payload is in pld.
+    on_single_data_queue_t msg;
+
+    //! The raw payload of msg
+    UInt8 pld[ONA_MAX_SINGLE_PACKET_PAYLOAD_LEN];
+
+    //! The packet as last sent.  It is rebuilt before it is sent again.
+    UInt8 pkt[ON_MAX_ENCODED_DATA_PKT_SIZE];
+
+    //! The recipients of msg still to send to
+    on_recipient_list_t recipients;
+
+    //! FALSE if the message had no recipient list
+    BOOL has_recipients;
+
+    //! How many times the data packet has been sent
+    UInt8 sends;
+
+    //! TRUE if any recipient of msg has responded
+    BOOL at_least_one_response;
+
+    //! When the transaction should be tried again
+    tick_t retry_time;
+} on_parked_txn_t;
+#endif
+
+#ifdef ONE_NET_MH_CLIENT_REPEATER
+/*!
+    \brief A packet that was recently repeated
+*/
+typedef struct
+{
+    //! Identifies the packet.  The CRC of the header from the message CRC
+    //! through the PID in the high byte, the CRC of the payload in the low
+    //! byte.
+    UInt16 tag;
+
+    //! Copies of the packet that arrive before this time are not repeated.
+    //! 0 if the entry is not in use.
+    tick_t expire_time;
+} on_mh_dup_entry_t;
+#endif
+
 //! @} ONE-NET_typedefs
 //                                  TYPEDEFS END
 //==============================================================================
@@ -120,6 +316,9 @@ on_pkt_hdlr_set_t pkt_hdlr;
 //! a function to retrieve the sender information
 one_net_get_sender_info_func_t get_sender_info;
 
+//! a function to retrieve the RAM-only sender information
+one_net_get_sender_ram_func_t get_sender_ram;
+
 
 #ifndef ONE_NET_MULTI_HOP
 //! Used to send a response
@@ -262,6 +461,17 @@ tick_t key_change_request_time = 0;
 extern BOOL features_override; // defined in one_net_message.c
 #endif
 
+#ifdef ONE_NET_MH_CLIENT_REPEATER
+//! Counts of repeats skipped because the packet was already repeated and
+//! of remembered packets pushed out of the cache early
+on_mh_dup_stats_t mh_dup_stats = {0, 0};
+#endif
+
+#ifdef ON_STATS
+//! Counters for the state machine.  See on_stats_update.
+on_stats_t on_stats;
+#endif
+
 #ifdef PID_BLOCK
 //! Stores which PIDs are accepted.
 pid_block_t pid_block_info = {0xFFFF, PID_ACCEPT, PID_ACCEPT};
@@ -302,6 +512,50 @@ static on_encoded_did_t range_test_did_array[RANGE_TESTING_ARRAY_SIZE];
 static BOOL range_testing_on = FALSE;
 #endif
 
+//! Number of times the data packet of the current single transaction has
+//! been sent.  Only a response to the first send is timed, since a response
+//! to a later one could be answering any of them.
+static UInt8 single_txn_sends = 0;
+
+//! The time the data packet of the current single transaction was last sent
+static tick_t single_txn_send_time = 0;
+
+#ifdef ONE_NET_MULTI_HOP
+//! Routes that were seen to work, by destination
+static on_route_cache_entry_t route_cache[ON_ROUTE_CACHE_SIZE];
+#endif
+
+#if defined(BLOCK_MESSAGES_ENABLED) && ON_BS_MAX_SESSIONS > 1
+//! The block / stream transfers that are not in bs_msg
+static on_bs_session_t bs_sessions[ON_BS_MAX_SESSIONS - 1];
+
+//! The timers a block / stream transfer owns
+static const UInt8 bs_session_timers[ON_BS_SESSION_NUM_TIMERS] =
+  {ONT_BS_TIMER, ONT_BS_TIMEOUT_TIMER};
+#endif
+
+#ifdef ON_PARK_SINGLE_TXNS
+//! Single transactions that timed out and are waiting to retry
+static on_parked_txn_t parked_txns[ON_SINGLE_TXN_WINDOW - 1];
+#endif
+
+#ifdef ONE_NET_MH_CLIENT_REPEATER
+//! Packets recently repeated, indexed by their tag
+static on_mh_dup_entry_t mh_dup_cache[ON_MH_DUP_CACHE_SIZE];
+#endif
+
+#ifdef ON_STATS
+//! The state on_stats_update last saw
+static UInt8 stats_state = ON_STATS_NO_STATE;
+
+//! The element of on_stats.state for stats_state, or ON_STATS_NO_STATE if
+//! the state is untracked
+static UInt8 stats_slot = ON_STATS_NO_STATE;
+
+//! The time of the last on_stats_update call
+static tick_t stats_tick = 0;
+#endif
+
 
 //! @} ONE-NET_pri_var
 //                              PRIVATE VARIABLES END
@@ -318,6 +572,30 @@ static BOOL range_testing_on = FALSE;
 static void check_dr_channel_change(void);
 #endif
 static BOOL check_for_clr_channel(void);
+static void update_response_time(const on_txn_t* txn, UInt32 response_ms);
+static UInt8 classify_rx_addresses(const UInt8* const pkt_bytes);
+#ifdef ON_MSG_ID_WINDOW
+static BOOL msg_id_in_window(const on_sending_device_t* const device,
+  UInt16 msg_id);
+static void msg_id_window_mark(on_sending_device_t* const device,
+  UInt16 msg_id);
+#endif
+#ifdef ONE_NET_MULTI_HOP
+static on_route_cache_entry_t* route_cache_entry(
+  const on_encoded_did_t* const dst);
+#ifdef ROUTE
+static void learn_route(const on_encoded_did_t* const dst,
+  const UInt8* const route);
+#endif
+#endif
+#ifdef ONE_NET_MH_CLIENT_REPEATER
+static BOOL mh_already_repeated(const on_pkt_t* const pkt);
+#endif
+#ifdef ON_PARK_SINGLE_TXNS
+static BOOL park_single_txn(UInt32 pause_ms, BOOL at_least_one_response);
+static BOOL resume_single_txn(int index, BOOL* const at_least_one_response);
+static void drop_resumed_single_txn(on_message_status_t status);
+#endif
 static on_message_status_t rx_single_resp_pkt(on_txn_t** const txn,
   on_txn_t** const this_txn, on_pkt_t* const pkt,
   UInt8* const raw_payload_bytes, on_ack_nack_t* const ack_nack);
@@ -328,6 +606,12 @@ static on_message_status_t rx_block_resp_pkt(on_txn_t* txn,
 static on_message_status_t rx_block_data(on_txn_t* txn, block_stream_msg_t* bs_msg,
   block_pkt_t* block_pkt, on_ack_nack_t* ack_nack);
 static void terminate_bs_complete(block_stream_msg_t* bs_msg);
+static void adapt_block_rate(block_stream_msg_t* bs_msg);
+#if ON_BS_MAX_SESSIONS > 1
+static BOOL bs_sessions_conflict(const block_stream_msg_t* a,
+  const block_stream_msg_t* b);
+static void bs_session_schedule(void);
+#endif
 #endif
 
 #ifdef STREAM_MESSAGES_ENABLED
@@ -372,6 +656,30 @@ void one_net_init(void)
     bs_msg.saved_ack_nack.payload = (ack_nack_payload_t*)
       bs_msg.saved_ack_nack_payload_bytes;
     bs_msg.use_saved_ack_nack = FALSE;
+    #if ON_BS_MAX_SESSIONS > 1
+    {
+        UInt8 i;
+        for(i = 0; i < ON_BS_MAX_SESSIONS - 1; i++)
+        {
+            bs_sessions[i].msg.transfer_in_progress = FALSE;
+        }
+    }
+    #endif
+    #endif
+    #ifdef ONE_NET_MULTI_HOP
+    route_cache_clear();
+    #endif
+    #ifdef ONE_NET_MH_CLIENT_REPEATER
+    one_net_memset(mh_dup_cache, 0, sizeof(mh_dup_cache));
+    #endif
+    #ifdef ON_PARK_SINGLE_TXNS
+    {
+        UInt8 i;
+        for(i = 0; i < ON_SINGLE_TXN_WINDOW - 1; i++)
+        {
+            parked_txns[i].txn.priority = ONE_NET_NO_PRIORITY;
+        }
+    }
     #endif
 } // one_net_init //
     
@@ -403,6 +711,10 @@ void one_net(on_txn_t ** txn)
     on_ack_nack_t ack_nack;
     ack_nack_payload_t ack_nack_payload;
     ack_nack.payload = &ack_nack_payload;
+    
+    #ifdef ON_STATS
+    on_stats_update();
+    #endif
 
     #ifdef BLOCK_MESSAGES_ENABLED
     if(on_state <= ON_BS_COMMENCE || on_state >= ON_BS_CHUNK_PAUSE)
@@ -494,6 +806,18 @@ void one_net(on_txn_t ** txn)
                     #else
                     int index = single_data_queue_ready_to_send();
                     #endif
+                    
+                    #ifdef ON_PARK_SINGLE_TXNS
+                    // a parked transaction goes first if it is due or if
+                    // the next message is to the same device.
+                    if(on_state == ON_LISTEN_FOR_DATA &&
+                      resume_single_txn(index, &at_least_one_response))
+                    {
+                        *txn = &single_txn;
+                        return;
+                    }
+                    #endif
+
                     if(index >= 0)
                     {
                         #if SINGLE_QUEUE_LEVEL > NO_SINGLE_QUEUE_LEVEL
@@ -595,6 +919,9 @@ void one_net(on_txn_t ** txn)
                     single_msg_ptr = NULL;
                     
                     #ifdef BLOCK_MESSAGES_ENABLED
+                    #if ON_BS_MAX_SESSIONS > 1
+                    bs_session_schedule();
+                    #endif
                     if(bs_msg.transfer_in_progress && !bs_msg.src)
                     {
                         UInt8 transfer_type =
@@ -637,6 +964,23 @@ void one_net(on_txn_t ** txn)
                                 case ON_BS_FIND_ROUTE:
                                     #ifdef ONE_NET_MULTI_HOP
                                     bs_msg.num_repeaters = 0;
+                                    {
+                                        UInt8 hops;
+                                        if(route_cache_repeaters(
+                                          (const on_encoded_did_t*)
+                                          &(bs_msg.dst->did), &hops,
+                                          &bs_msg.num_repeaters,
+                                          bs_msg.repeaters))
+                                        {
+                                            // we already know the route, so
+                                            // skip finding it.
+                                            set_bs_hops(&bs_msg.flags, hops);
+                                            bs_msg.bs_on_state =
+                                              ON_BS_WAIT_FOR_FIND_ROUTE_RESP
+                                              + 1;
+                                            break;
+                                        }
+                                    }
                                     #endif
                                 case ON_BS_CONFIRM_ROUTE:
                                     send_route_msg((const on_raw_did_t*)
@@ -824,6 +1168,13 @@ void one_net(on_txn_t ** txn)
                                       MS_TO_TICK(bs_msg.timeout));
                                     one_net_memset(bs_msg.bs.block.sent, 0,
                                       sizeof(bs_msg.bs.block.sent));
+                                    bs_msg.bs.block.max_chunk_size =
+                                      bs_msg.bs.block.chunk_size;
+                                    bs_msg.bs.block.chunk_losses = 0;
+                                    bs_msg.bs.block.base_frag_dly =
+                                      bs_msg.frag_dly;
+                                    bs_msg.bs.block.base_chunk_pause =
+                                      bs_msg.bs.block.chunk_pause;
                                     
                                     // we'll make fairly long process times.
                                     // Things will get corrected soon enough
@@ -963,12 +1314,22 @@ void one_net(on_txn_t ** txn)
 
                             if(msg_status == ON_MSG_CONTINUE)
                             {
-                                (*pkt_hdlr.single_data_hdlr)(&this_txn,
-                                  this_pkt_ptrs, raw_payload_bytes, &msg_type,
-                                  &ack_nack);
+                                msg_status = (*pkt_hdlr.single_data_hdlr)(
+                                  &this_txn, this_pkt_ptrs, raw_payload_bytes,
+                                  &msg_type, &ack_nack);
+                                ON_STATS_STATUS(msg_status);
                             }
 
-                            if(this_txn == &response_txn)
+                            if(this_txn == &response_txn &&
+                              is_broadcast_did((const on_encoded_did_t*)
+                              &(this_pkt_ptrs->packet_bytes[
+                              ON_ENCODED_DST_DID_IDX])))
+                            {
+                                // nobody answers a broadcast.  Every device
+                                // that heard it would answer at once.
+                                *txn = 0;
+                            }
+                            else if(this_txn == &response_txn)
                             {
                                 // we'll send back a reply.
                                 *txn = &response_txn;
@@ -1163,8 +1524,10 @@ void one_net(on_txn_t ** txn)
                 single_txn.priority = single_msg.priority;
                 *txn = &single_txn;
                 (*txn)->retry = 0;
-                (*txn)->response_timeout = one_net_response_time_out;
+                (*txn)->response_timeout =
+                  one_net_device_response_timeout(device);
                 (*txn)->device = device;
+                single_txn_sends = 0;
                 
                 // we'll need to fill in the key.  We're dealing with
                 // a single transaction here.  Fill in the key.
@@ -1209,6 +1572,16 @@ void one_net(on_txn_t ** txn)
                 on_decode(raw_did, device->did, ON_ENCODED_DID_LEN);
                 single_txn.hops = 0;
                 single_txn.max_hops = device->hops;
+                {
+                    // a route that was seen working recently beats what we
+                    // last used with this device.
+                    SInt8 cached_hops = route_cache_hops(
+                      (const on_encoded_did_t*) &(device->did));
+                    if(cached_hops >= 0)
+                    {
+                        single_txn.max_hops = (UInt8) cached_hops;
+                    }
+                }
 
                 // give the application code a chance to override if it
                 // wants to.
@@ -1320,6 +1693,10 @@ void one_net(on_txn_t ** txn)
             // need to set our own buffer.  However, the stack size shouldn't
             // be very high here so it's no big deal.
             UInt8 buffer[ON_BS_DATA_PLD_SIZE];
+            // the data to send.  Points into the transfer's registered
+            // buffer if the packet's data is all there.
+            const UInt8* pld = buffer;
+            UInt8 pld_len = ON_BS_DATA_PLD_SIZE;
             ack_nack.nack_reason = ON_NACK_RSN_NO_ERROR;
             ack_nack.handle = ON_ACK;
             
@@ -1349,8 +1726,19 @@ void one_net(on_txn_t ** txn)
             if(transfer_type == ON_BLK_TRANSFER)
             #endif
             {
-                msg_status = one_net_block_get_next_payload(&bs_msg, buffer,
-                  &ack_nack);
+                UInt8* data = block_buffer_data(&bs_msg,
+                  bs_msg.bs.block.byte_idx, bs_msg.bs.block.chunk_idx,
+                  &pld_len);
+                if(data)
+                {
+                    msg_status = ON_MSG_CONTINUE;
+                    pld = data;
+                }
+                else
+                {
+                    msg_status = one_net_block_get_next_payload(&bs_msg,
+                      buffer, &ack_nack);
+                }
             }
             #ifdef STREAM_MESSAGES_ENABLED
             else
@@ -1361,10 +1749,30 @@ void one_net(on_txn_t ** txn)
                   bs_msg.bs.stream.last_response_time > STREAM_RESPONSE_INTERVAL);
                 bs_msg.bs.stream.elapsed_time = TICK_TO_MS(tick_now -
                   bs_msg.bs.stream.start_time);
-                msg_status = one_net_stream_get_next_payload(&bs_msg, buffer,
-                  &ack_nack);
+                {
+                    UInt8* data = stream_buffer_next(&bs_msg, &pld_len);
+                    if(data)
+                    {
+                        msg_status = ON_MSG_CONTINUE;
+                        pld = data;
+                    }
+                    else
+                    {
+                        msg_status = one_net_stream_get_next_payload(&bs_msg,
+                          buffer, &ack_nack);
+                    }
+                }
             }
             #endif
+            
+            if(pld != buffer && pld_len < ON_BS_DATA_PLD_SIZE)
+            {
+                // the end of the data.  Pad it out.
+                one_net_memmove(buffer, pld, pld_len);
+                one_net_memset(&buffer[pld_len], 0,
+                  ON_BS_DATA_PLD_SIZE - pld_len);
+                pld = buffer;
+            }
                   
             if(msg_status == ON_MSG_CONTINUE)
             {
@@ -1398,7 +1806,7 @@ void one_net(on_txn_t ** txn)
                     bs_msg.response_needed = (bs_msg.bs.block.chunk_idx + 1 ==
                       bs_msg.bs.block.chunk_size);
 
-                    status = on_build_data_pkt(buffer, ON_APP_MSG,
+                    status = on_build_data_pkt(pld, ON_APP_MSG,
                       &data_pkt_ptrs, &bs_txn, &bs_msg);
                     // change back if it was changed before.
                     bs_msg.bs.block.chunk_size = (UInt8) original_chunk_size;
@@ -1411,7 +1819,7 @@ void one_net(on_txn_t ** txn)
                         terminate_bs_msg(&bs_msg, NULL, ON_MSG_SUCCESS, NULL);
                         return;
                     }
-                    status = on_build_data_pkt(buffer, ON_APP_MSG,
+                    status = on_build_data_pkt(pld, ON_APP_MSG,
                       &data_pkt_ptrs, &bs_txn, &bs_msg);
                 }
                 #endif
@@ -1502,6 +1910,7 @@ void one_net(on_txn_t ** txn)
                 {
                     one_net_write((*txn)->pkt, get_encoded_packet_len(raw_pid,
                       TRUE));
+                    ON_STATS_PID(on_stats.tx_pid, raw_pid);
                     on_state++;
                 }
                 #ifdef BLOCK_MESSAGES_ENABLED
@@ -1688,6 +2097,28 @@ void one_net(on_txn_t ** txn)
                 else
                 #endif
                 {
+                    if(on_state == ON_SEND_SINGLE_DATA_WRITE_WAIT)
+                    {
+                        single_txn_sends++;
+                        single_txn_send_time = get_tick_count();
+                        
+                        if(is_broadcast_did((const on_encoded_did_t*)
+                          &((*txn)->pkt[ON_ENCODED_DST_DID_IDX])))
+                        {
+                            // nobody answers a broadcast, so it is done as
+                            // soon as it has been sent.
+                            ack_nack.handle = ON_ACK;
+                            ack_nack.nack_reason = ON_NACK_RSN_NO_ERROR;
+                            (*pkt_hdlr.single_txn_hdlr)(txn, &data_pkt_ptrs,
+                              single_msg.payload, &(single_msg.msg_type),
+                              ON_MSG_SUCCESS, &ack_nack);
+                            single_msg_ptr = NULL;
+                            (*txn)->priority = ONE_NET_NO_PRIORITY;
+                            *txn = 0;
+                            on_state = ON_LISTEN_FOR_DATA;
+                            break;
+                        }
+                    }
                     ont_set_timer(ONT_RESPONSE_TIMER, MS_TO_TICK(new_timeout_ms));
                     on_state++;
                 }
@@ -1749,7 +2180,16 @@ void one_net(on_txn_t ** txn)
                     else
                     {
                         // no response, so prepare the next packet, which may
-                        // may or may not be this one.
+                        // may or may not be this one.  Either the last packet
+                        // or the response was lost.  bs is a union, so
+                        // only count the loss for a block transfer.
+                        #ifdef STREAM_MESSAGES_ENABLED
+                        if(get_bs_transfer_type(bs_msg.flags) ==
+                          ON_BLK_TRANSFER)
+                        #endif
+                        {
+                            bs_msg.bs.block.chunk_losses++;
+                        }
                         on_state = ON_BS_PREPARE_DATA_PACKET;
                     }
                     
@@ -1759,11 +2199,30 @@ void one_net(on_txn_t ** txn)
                 
                 response_msg_or_timeout = TRUE;
                 (*txn)->retry++;
+                #ifdef ON_STATS
+                on_stats.retries++;
+                #endif
+
+                // back off before trying again.
+                if((*txn)->response_timeout < ON_MAX_RESPONSE_TIME_OUT_FACTOR *
+                  one_net_response_time_out)
+                {
+                    (*txn)->response_timeout *= 2;
+                    if((*txn)->response_timeout >
+                      ON_MAX_RESPONSE_TIME_OUT_FACTOR *
+                      one_net_response_time_out)
+                    {
+                        (*txn)->response_timeout =
+                          ON_MAX_RESPONSE_TIME_OUT_FACTOR *
+                          one_net_response_time_out;
+                    }
+                }
                 
                 #ifndef ONE_NET_SIMPLE_CLIENT
                 msg_status = (*pkt_hdlr.single_ack_nack_hdlr)(&single_txn,
                   &data_pkt_ptrs, single_msg_ptr->payload,
                   &(single_msg_ptr->msg_type), &ack_nack);
+                ON_STATS_STATUS(msg_status);
                   
                 // we may have been given a pause by the application code,
                 // so check if it has changed the nack handle to
@@ -1858,6 +2317,13 @@ void one_net(on_txn_t ** txn)
                             terminate_txn = TRUE;
                             break;
                         default:
+                            if(on_state == ON_WAIT_FOR_SINGLE_DATA_RESP &&
+                              single_txn_sends == 1)
+                            {
+                                update_response_time(*txn,
+                                  TICK_TO_MS(get_tick_count() -
+                                  single_txn_send_time));
+                            }
                             terminate_txn = ((*txn)->retry >= ON_MAX_RETRY ||
                               this_txn == 0);
                             #ifndef ONE_NET_SIMPLE_CLIENT
@@ -1909,6 +2375,20 @@ void one_net(on_txn_t ** txn)
                 
                 if(!terminate_txn)
                 {
+                    #ifdef ON_PARK_SINGLE_TXNS
+                    if(on_state == ON_WAIT_FOR_SINGLE_DATA_RESP &&
+                      ack_nack.nack_reason == ON_NACK_RSN_NO_RESPONSE &&
+                      park_single_txn(next_send_pause_time,
+                      at_least_one_response))
+                    {
+                        // messages to other devices go while this one
+                        // waits to retry.
+                        *txn = NULL;
+                        on_state = ON_LISTEN_FOR_DATA;
+                        break;
+                    }
+                    #endif
+
                     #ifndef ONE_NET_SIMPLE_CLIENT
                     ont_set_timer((*txn)->next_txn_timer,
                       MS_TO_TICK(next_send_pause_time));
@@ -1963,6 +2443,24 @@ void one_net(on_txn_t ** txn)
                 }
                 #endif
                 
+                #ifdef ONE_NET_MULTI_HOP
+                if(ack_nack.nack_reason == ON_NACK_RSN_NO_RESPONSE ||
+                  ack_nack.nack_reason == ON_NACK_RSN_NO_RESPONSE_TXN)
+                {
+                    // whatever route we had to this device did not work.
+                    route_cache_invalidate((const on_encoded_did_t*)
+                      &((*txn)->device->did));
+                }
+                #ifdef ROUTE
+                else if(ack_nack.nack_reason == ON_NACK_RSN_NO_ERROR &&
+                  single_msg.msg_type == ON_ROUTE_MSG)
+                {
+                    learn_route((const on_encoded_did_t*)
+                      &((*txn)->device->did), ack_nack.payload->ack_payload);
+                }
+                #endif
+                #endif
+                
                 #if  SINGLE_QUEUE_LEVEL == NO_SINGLE_QUEUE_LEVEL
                 if(!recipient_send_list_ptr ||
                   recipient_send_list_ptr->num_recipients -
@@ -2194,6 +2692,7 @@ static on_message_status_t rx_single_resp_pkt(on_txn_t** const txn,
     msg_status = (*pkt_hdlr.single_ack_nack_hdlr)(&single_txn,
       &data_pkt_ptrs, single_msg_ptr->payload,
       &(single_msg_ptr->msg_type), ack_nack);
+    ON_STATS_STATUS(msg_status);
     
     if(msg_status == ON_BS_MSG_SETUP_CHANGE)
     {
@@ -2218,6 +2717,9 @@ static on_message_status_t rx_single_resp_pkt(on_txn_t** const txn,
     if(ack_nack->nack_reason != ON_NACK_RSN_NO_ERROR)
     {
         ((*txn)->retry)++;
+        #ifdef ON_STATS
+        on_stats.retries++;
+        #endif
     }
     else
     {
@@ -2316,6 +2818,8 @@ on_message_status_t rx_single_data(on_txn_t** txn, on_pkt_t* sing_pkt_ptr,
     {
         (*txn)->device->hops = sing_pkt_ptr->hops;
         (*txn)->hops = (*txn)->device->hops;
+        route_cache_add((const on_encoded_did_t*) &((*txn)->device->did),
+          (*txn)->device->hops, ON_ROUTE_REPEATERS_UNKNOWN, NULL);
         
         // assume it will take as many hops to get back as it took to get
         // there.  Application code will change if it likes.
@@ -2423,7 +2927,20 @@ on_message_status_t rx_single_data(on_txn_t** txn, on_pkt_t* sing_pkt_ptr,
             (*txn)->device->msg_id = sing_pkt_ptr->msg_id;
             (*txn)->device->verify_time = 0;
             ack_nack->nack_reason = ON_NACK_RSN_NO_ERROR;
+            #ifdef ON_MSG_ID_WINDOW
+            msg_id_window_mark((*txn)->device, sing_pkt_ptr->msg_id);
+            #endif
+        }
+        #ifdef ON_MSG_ID_WINDOW
+        else if(msg_id_in_window((*txn)->device, sing_pkt_ptr->msg_id))
+        {
+            // An older message we have not seen yet.  It was probably
+            // delayed on another path.  Accept it without moving the
+            // message id back.
+            msg_id_window_mark((*txn)->device, sing_pkt_ptr->msg_id);
+            ack_nack->nack_reason = ON_NACK_RSN_NO_ERROR;
         }
+        #endif
         else if(sing_pkt_ptr->msg_id == (*txn)->device->msg_id)
         {
             if((*txn)->device->verify_time == 0)
@@ -2498,6 +3015,7 @@ static on_message_status_t rx_block_resp_pkt(on_txn_t* txn,
     // send it up to the application code.
     status = (*pkt_hdlr.block_ack_nack_hdlr)(txn, bs_msg, pkt,
       raw_payload_bytes, ack_nack);
+    ON_STATS_STATUS(status);
       
     if(terminating_did)
     {
@@ -2538,9 +3056,20 @@ static on_message_status_t rx_block_resp_pkt(on_txn_t* txn,
           pause_bs_msg(bs_msg, ack_nack->payload->nack_time_ms);
           break;
         case ON_ACK_BLK_PKTS_RCVD:
-          one_net_memmove(bs_msg->bs.block.sent, ack_nack->payload->ack_payload,
-            sizeof(bs_msg->bs.block.sent));
-          return ON_MSG_CONTINUE;
+        {
+            UInt8 i;
+            UInt8 current_chunk_size = get_current_bs_chunk_size(bs_msg);
+            for(i = 0; i < current_chunk_size; i++)
+            {
+                if(!block_get_index_sent(i, ack_nack->payload->ack_payload))
+                {
+                    (bs_msg->bs.block.chunk_losses)++;
+                }
+            }
+            one_net_memmove(bs_msg->bs.block.sent, ack_nack->payload->ack_payload,
+              sizeof(bs_msg->bs.block.sent));
+            return ON_MSG_CONTINUE;
+        }
         default:
         {
             switch(ack_nack->nack_reason)
@@ -2550,6 +3079,12 @@ static on_message_status_t rx_block_resp_pkt(on_txn_t* txn,
                       ack_nack->payload->nack_time_ms;
                     break;
                 case ON_NACK_RSN_INVALID_BYTE_INDEX:
+                    if((SInt32) ack_nack->payload->nack_value >
+                      bs_msg->bs.block.byte_idx)
+                    {
+                        // the chunk is done.  Size the next one.
+                        adapt_block_rate(bs_msg);
+                    }
                     bs_msg->bs.block.byte_idx = ack_nack->payload->nack_value;
                     
                     // TODO -- why is one of these unsigned?
@@ -2627,6 +3162,7 @@ one_net_status_t on_rx_packet(on_txn_t** this_txn, on_pkt_t** this_pkt_ptrs,
     #endif
     on_data_t type = ON_NO_TXN;
     UInt8* pkt_bytes;
+    UInt8 addresses;
     BOOL src_is_master;
     
     #ifdef BLOCK_MESSAGES_ENABLED
@@ -2667,16 +3203,45 @@ one_net_status_t on_rx_packet(on_txn_t** this_txn, on_pkt_t** this_pkt_ptrs,
     }
     #endif    
     
+    // Sort out the addresses before anything is decoded so that packets
+    // that are nothing to us are dropped as early as possible.
+    addresses = classify_rx_addresses(pkt_bytes);
+    dst_is_broadcast = ((addresses & ON_RX_DST_BROADCAST) != 0);
+    dst_is_me = ((addresses & ON_RX_DST_ME) != 0);
+    src_match = ((addresses & ON_RX_SRC_EXPECTED) != 0);
+    // TODO -- should master messages ever be discarded?
+    src_is_master = ((addresses & ON_RX_SRC_MASTER) != 0);
+    #ifdef BLOCK_MESSAGES_ENABLED
+    src_is_bs_endpoint = ((addresses & ON_RX_SRC_BS_ENDPOINT) != 0);
+    #ifdef ONE_NET_MH_CLIENT_REPEATER
+    dst_is_bs_endpoint = ((addresses & ON_RX_DST_BS_ENDPOINT) != 0);
+    dst_is_master = ((addresses & ON_RX_DST_MASTER) != 0);
+    #endif
+    #endif
+    
     #ifdef ONE_NET_MULTI_HOP
     // first check the source.  If it was us originally, then we probably
     // got back our own repeated packet.
-    if(is_my_did((const on_encoded_did_t* const)
-      &pkt_bytes[ON_ENCODED_SRC_DID_IDX]))
+    if(addresses & ON_RX_SRC_ME)
     {
         return ONS_DID_FAILED; // We SENT this packet, so no sense RECEIVING
                                // it.
     }
     #endif
+    
+    #ifndef ONE_NET_MH_CLIENT_REPEATER
+    if(!src_match || (!dst_is_me && !dst_is_broadcast))
+    {
+        return ONS_BAD_ADDR;
+    }
+    #else
+    if((!src_match || (!dst_is_me && !dst_is_broadcast)) && (dst_is_me ||
+      device_is_master || txn))
+    {
+        // not for us and not one we would repeat, whatever its PID.
+        return ONS_BAD_PARAM;
+    }
+    #endif
 
     #ifdef RANGE_TESTING
     if(!device_in_range((on_encoded_did_t*)
@@ -2702,56 +3267,11 @@ one_net_status_t on_rx_packet(on_txn_t** this_txn, on_pkt_t** this_pkt_ptrs,
     }
     #endif
 
-    dst_is_broadcast = is_broadcast_did((const on_encoded_did_t*)
-      (&pkt_bytes[ON_ENCODED_DST_DID_IDX]));
-    dst_is_me = is_my_did((const on_encoded_did_t* const)
-      (&pkt_bytes[ON_ENCODED_DST_DID_IDX]));
-    src_match = is_broadcast_did((const on_encoded_did_t* const)
-      &expected_src_did) || on_encoded_did_equal((const on_encoded_did_t* const)
-      &expected_src_did,(const on_encoded_did_t* const)
-      &pkt_bytes[ON_ENCODED_SRC_DID_IDX]);
-      
-    // TODO -- should master messages ever be discarded?
-    src_is_master = is_master_did(
-      (const on_encoded_did_t*) &pkt_bytes[ON_ENCODED_SRC_DID_IDX]);
-      
-    #ifdef BLOCK_MESSAGES_ENABLED
-    {
-        // note that these values might be garbage if we are not in the
-        // middle of a block / stream transfer.  It's OK if they are because
-        // the values will only be used if we are in a block / stream transfer.
-        on_encoded_did_t* bs_src_did = get_encoded_did_from_sending_device(
-          bs_msg.src);
-        on_encoded_did_t* bs_dst_did = get_encoded_did_from_sending_device(
-          bs_msg.dst);
-        
-        src_is_bs_endpoint = on_encoded_did_equal(
-          (const on_encoded_did_t* const)bs_src_did,
-          (const on_encoded_did_t* const) &pkt_bytes[ON_ENCODED_SRC_DID_IDX]) ||
-          on_encoded_did_equal((const on_encoded_did_t* const) bs_dst_did,
-          (const on_encoded_did_t*const) &pkt_bytes[ON_ENCODED_SRC_DID_IDX]);
-        #ifdef ONE_NET_MH_CLIENT_REPEATER
-        dst_is_bs_endpoint = on_encoded_did_equal(
-          (const on_encoded_did_t* const)bs_src_did,
-          (const on_encoded_did_t* const) &pkt_bytes[ON_ENCODED_DST_DID_IDX]) ||
-          on_encoded_did_equal((const on_encoded_did_t* const) bs_dst_did,
-          (const on_encoded_did_t* const) &pkt_bytes[ON_ENCODED_DST_DID_IDX]);
-        dst_is_master = is_master_did((const on_encoded_did_t* const)
-          (const on_encoded_did_t* const) &pkt_bytes[ON_ENCODED_DST_DID_IDX]);
-        #endif
-    }
-    #endif
-    
     #ifdef ONE_NET_MULTI_HOP
     packet_is_mh = packet_is_multihop(raw_pid);
     #endif
     
-    #ifndef ONE_NET_MH_CLIENT_REPEATER
-    if(!src_match || (!dst_is_me && !dst_is_broadcast))
-    {
-        return ONS_BAD_ADDR;
-    }
-    #else
+    #ifdef ONE_NET_MH_CLIENT_REPEATER
     if(!src_match || (!dst_is_me && !dst_is_broadcast) || ((raw_pid & 0x3F) ==
       ONE_NET_RAW_MASTER_INVITE_NEW_CLIENT && client_joined_network))
     {
@@ -2969,6 +3489,13 @@ one_net_status_t on_rx_packet(on_txn_t** this_txn, on_pkt_t** this_pkt_ptrs,
                 return ONS_UNHANDLED_PKT;
             }
             
+            if(mh_already_repeated(*this_pkt_ptrs))
+            {
+                // we repeated this packet when it reached us over another
+                // path.  Repeating it again only adds to the traffic.
+                return ONS_UNHANDLED_PKT;
+            }
+            
             // we have everything.  Increment the hops, add ourself as the
             // repeater, pause a very short time, and send the message.
             ((*this_pkt_ptrs)->hops)++;
@@ -3063,12 +3590,26 @@ one_net_status_t on_rx_packet(on_txn_t** this_txn, on_pkt_t** this_pkt_ptrs,
     
     // message id is irrelevant for invite packets, but fill it in regardless.
     (*this_pkt_ptrs)->msg_id = get_payload_msg_id(raw_payload_bytes);
+    ON_STATS_PID(on_stats.rx_pid, raw_pid);
+    
+    // decode the addresses once for all of the handlers.
+    if(on_decode((*this_pkt_ptrs)->raw_src_did,
+      &((*this_pkt_ptrs)->packet_bytes[ON_ENCODED_SRC_DID_IDX]),
+      ON_ENCODED_DID_LEN) != ONS_SUCCESS ||
+      on_decode((*this_pkt_ptrs)->raw_dst_did,
+      &((*this_pkt_ptrs)->packet_bytes[ON_ENCODED_DST_DID_IDX]),
+      ON_ENCODED_DID_LEN) != ONS_SUCCESS ||
+      on_decode((*this_pkt_ptrs)->raw_rptr_did,
+      &((*this_pkt_ptrs)->packet_bytes[ON_ENCODED_RPTR_DID_IDX]),
+      ON_ENCODED_DID_LEN) != ONS_SUCCESS)
+    {
+        return ONS_BAD_ENCODING;
+    }
     
     #if defined(ONE_NET_MH_CLIENT_REPEATER) && defined(ROUTE)
     if(repeat_route_packet)
     {
         on_raw_did_t my_raw_did;
-        on_raw_did_t raw_src_did;
         SInt8 src_idx;
         UInt8 msg_crc;
         
@@ -3085,15 +3626,9 @@ one_net_status_t on_rx_packet(on_txn_t** this_txn, on_pkt_t** this_pkt_ptrs,
         {
             return ONS_INTERNAL_ERR;
         }
-        if(on_decode(raw_src_did,
-          &((*this_pkt_ptrs)->packet_bytes[ON_ENCODED_SRC_DID_IDX]),
-          ON_ENCODED_DID_LEN) != ONS_SUCCESS)
-        {
-            return ONS_BAD_ENCODING;
-        }
         
         src_idx = find_raw_did_in_route(&raw_payload_bytes[ON_PLD_DATA_IDX],
-          (const on_raw_did_t* const) raw_src_did, 0);
+          (const on_raw_did_t* const) (*this_pkt_ptrs)->raw_src_did, 0);
           
         // see if we are already in this route
         if(find_raw_did_in_route(&raw_payload_bytes[ON_PLD_DATA_IDX],
@@ -3393,15 +3928,243 @@ BOOL device_in_range(on_encoded_did_t* did)
 #endif
 
 
-#ifdef ROUTE
-one_net_status_t send_route_msg(const on_raw_did_t* raw_did)
+#ifdef ONE_NET_MULTI_HOP
+/*!
+    \brief Remembers a route that was seen to work.
+
+    If the destination is already in the cache, its entry is replaced.
+    Otherwise an empty entry, or failing that the one that has gone longest
+    without being seen working, is used.  If only the hop count is given and
+    it matches the entry's, the repeaters already known are kept.
+
+    \param[in] dst The destination.
+    \param[in] hops The hops needed to get there and back (whichever is more)
+    \param[in] num_repeaters The number of repeaters, or
+      ON_ROUTE_REPEATERS_UNKNOWN if only the hop count is known.
+    \param[in] repeaters The repeaters, far to near.  Ignored if
+      num_repeaters is ON_ROUTE_REPEATERS_UNKNOWN.
+
+    \return void
+*/
+void route_cache_add(const on_encoded_did_t* const dst, UInt8 hops,
+  UInt8 num_repeaters, const on_encoded_did_t* repeaters)
 {
-    UInt8 raw_pld[ONA_EXTENDED_SINGLE_PACKET_PAYLOAD_LEN];
-    on_encoded_did_t enc_dst;
-    one_net_status_t status;
-    on_raw_did_t my_raw_did;
-    
-    
+    UInt8 i;
+    on_route_cache_entry_t* entry;
+    tick_t time_now = get_tick_count();
+
+    if(!dst || hops > ON_MAX_HOPS_LIMIT || (num_repeaters !=
+      ON_ROUTE_REPEATERS_UNKNOWN && (num_repeaters > ON_MAX_HOPS_LIMIT ||
+      !repeaters)))
+    {
+        return;
+    }
+
+    if(!(entry = route_cache_entry(dst)))
+    {
+        // not there.  Take the stalest entry.  Unused entries are never
+        // newer than used ones.
+        entry = &route_cache[0];
+        for(i = 1; i < ON_ROUTE_CACHE_SIZE; i++)
+        {
+            if(is_broadcast_did((const on_encoded_did_t*)
+              &(entry->did)))
+            {
+                break;
+            }
+            if(is_broadcast_did((const on_encoded_did_t*)
+              &(route_cache[i].did)) || time_now - route_cache[i].seen_time >
+              time_now - entry->seen_time)
+            {
+                entry = &route_cache[i];
+            }
+        }
+        one_net_memmove(entry->did, *dst, ON_ENCODED_DID_LEN);
+        entry->num_repeaters = ON_ROUTE_REPEATERS_UNKNOWN;
+    }
+
+    if(num_repeaters != ON_ROUTE_REPEATERS_UNKNOWN)
+    {
+        entry->num_repeaters = num_repeaters;
+        one_net_memmove(entry->repeaters, repeaters,
+          num_repeaters * ON_ENCODED_DID_LEN);
+    }
+    else if(hops != entry->hops)
+    {
+        // the route has changed, so the repeaters we knew are no good.
+        entry->num_repeaters = ON_ROUTE_REPEATERS_UNKNOWN;
+    }
+
+    entry->hops = hops;
+    entry->seen_time = time_now;
+}
+
+
+/*!
+    \brief Looks up the number of hops to use for a destination.
+
+    \param[in] dst The destination.
+
+    \return The hops of the cached route.
+            -1 if there is no route for the destination or it has aged out.
+*/
+SInt8 route_cache_hops(const on_encoded_did_t* const dst)
+{
+    on_route_cache_entry_t* entry = route_cache_entry(dst);
+    return entry ? (SInt8) entry->hops : -1;
+}
+
+
+/*!
+    \brief Looks up the repeaters to use for a destination.
+
+    \param[in] dst The destination.
+    \param[out] hops The hops of the cached route.
+    \param[out] num_repeaters The number of repeaters in the cached route.
+    \param[out] repeaters The repeaters, far to near.  Must hold
+      ON_MAX_HOPS_LIMIT DIDs.
+
+    \return TRUE if the repeaters to the destination are known.
+            FALSE otherwise.
+*/
+BOOL route_cache_repeaters(const on_encoded_did_t* const dst, UInt8* hops,
+  UInt8* num_repeaters, on_encoded_did_t* repeaters)
+{
+    on_route_cache_entry_t* entry = route_cache_entry(dst);
+
+    if(!entry || entry->num_repeaters == ON_ROUTE_REPEATERS_UNKNOWN ||
+      !hops || !num_repeaters || !repeaters)
+    {
+        return FALSE;
+    }
+
+    *hops = entry->hops;
+    *num_repeaters = entry->num_repeaters;
+    one_net_memmove(repeaters, entry->repeaters,
+      entry->num_repeaters * ON_ENCODED_DID_LEN);
+    return TRUE;
+}
+
+
+/*!
+    \brief Forgets the route to a destination.
+
+    Called when a transaction with the destination fails, so the next one
+    finds its route again.
+
+    \param[in] dst The destination.
+
+    \return void
+*/
+void route_cache_invalidate(const on_encoded_did_t* const dst)
+{
+    on_route_cache_entry_t* entry = route_cache_entry(dst);
+    if(entry)
+    {
+        one_net_memmove(entry->did, ON_ENCODED_BROADCAST_DID,
+          ON_ENCODED_DID_LEN);
+    }
+}
+
+
+/*!
+    \brief Forgets all routes.
+
+    \return void
+*/
+void route_cache_clear(void)
+{
+    UInt8 i;
+    for(i = 0; i < ON_ROUTE_CACHE_SIZE; i++)
+    {
+        one_net_memmove(route_cache[i].did, ON_ENCODED_BROADCAST_DID,
+          ON_ENCODED_DID_LEN);
+    }
+}
+#endif
+
+
+#ifdef ON_STATS
+/*!
+    \brief Charges the time since the last call to the current state.
+
+    Called each time one_net() is called.  The time between two calls is
+    charged to the state the first call left the device in, and a state is
+    counted as entered when a call finds the device in a different state than
+    the last call did.  States entered and left within a single call are not
+    seen.
+
+    \return void
+*/
+void on_stats_update(void)
+{
+    tick_t now = get_tick_count();
+    
+    // stats_slot is not a state until the first call after start up or a
+    // reset, so nothing is charged for the time before then.
+    if(stats_slot != ON_STATS_NO_STATE)
+    {
+        on_stats.state[stats_slot].ticks += now - stats_tick;
+    }
+    stats_tick = now;
+    
+    if(on_state != stats_state)
+    {
+        stats_state = on_state;
+        for(stats_slot = 0; stats_slot < on_stats.num_states; stats_slot++)
+        {
+            if(on_stats.state[stats_slot].state == stats_state)
+            {
+                break;
+            }
+        }
+        
+        if(stats_slot == on_stats.num_states)
+        {
+            if(stats_slot >= ON_STATS_MAX_STATES)
+            {
+                stats_slot = ON_STATS_NO_STATE;
+                on_stats.untracked_entries++;
+            }
+            else
+            {
+                on_stats.state[stats_slot].state = stats_state;
+                on_stats.num_states++;
+            }
+        }
+        
+        if(stats_slot != ON_STATS_NO_STATE)
+        {
+            on_stats.state[stats_slot].entries++;
+        }
+    }
+}
+
+
+/*!
+    \brief Clears all of the counters in on_stats.
+
+    \return void
+*/
+void on_stats_reset(void)
+{
+    one_net_memset(&on_stats, 0, sizeof(on_stats));
+    stats_state = ON_STATS_NO_STATE;
+    stats_slot = ON_STATS_NO_STATE;
+    stats_tick = get_tick_count();
+}
+#endif
+
+
+#ifdef ROUTE
+one_net_status_t send_route_msg(const on_raw_did_t* raw_did)
+{
+    UInt8 raw_pld[ONA_EXTENDED_SINGLE_PACKET_PAYLOAD_LEN];
+    on_encoded_did_t enc_dst;
+    one_net_status_t status;
+    on_raw_did_t my_raw_did;
+    
+    
     if((status = on_encode(enc_dst, *raw_did, ON_ENCODED_DID_LEN)) !=
       ONS_SUCCESS)
     {
@@ -3987,6 +4750,44 @@ BOOL one_net_reject_bad_msg_id(const on_sending_device_t* device)
 }
 
 
+/*!
+    \brief Calculates how long to wait for a device to respond.
+
+    The timeout is the device's smoothed response time plus four times its
+    mean deviation, the way TCP does it.  Devices that have not been timed
+    yet get one_net_response_time_out.  The timeout is per hop, just like
+    one_net_response_time_out.
+
+    \param[in] device The device that will be sent a message.
+
+    \return The response timeout in ms.
+*/
+UInt16 one_net_device_response_timeout(const on_sending_device_t* device)
+{
+    UInt32 timeout;
+    const on_sending_device_ram_t* ram = device ? (*get_sender_ram)(device) :
+      NULL;
+
+    if(!ram || !ram->srtt)
+    {
+        return (UInt16) one_net_response_time_out;
+    }
+
+    timeout = (UInt32) ram->srtt + 4 * (UInt32) ram->rttvar;
+    if(timeout < ON_MIN_RESPONSE_TIME_OUT)
+    {
+        timeout = ON_MIN_RESPONSE_TIME_OUT;
+    }
+    else if(timeout > ON_MAX_RESPONSE_TIME_OUT_FACTOR *
+      one_net_response_time_out)
+    {
+        timeout = ON_MAX_RESPONSE_TIME_OUT_FACTOR * one_net_response_time_out;
+    }
+
+    return (UInt16) timeout;
+}
+
+
 #ifdef BLOCK_MESSAGES_ENABLED
 // TODO -- Do we really want to require block messages for this function?
 
@@ -4146,6 +4947,79 @@ void adjust_bs_frag_delay(block_stream_msg_t* msg, UInt16 frag_delay)
 }
 
 
+/*!
+    \brief Finds a place for a new block / stream transfer this device sends.
+
+    If no transfer is in progress, the new one goes in bs_msg.  Otherwise, if
+    ON_BS_MAX_SESSIONS allows, it is parked until it gets a turn.  Transfers
+    only run side by side if they do not get in each other's way.  See
+    bs_sessions_conflict.
+
+    The caller fills in the returned message and sets transfer_in_progress
+    when it is ready to go.
+
+    \param[in] msg The new transfer.  Only the destination, channel, and data
+      rate are looked at.
+
+    \return The message to fill in.
+            NULL if the device is busy.
+*/
+block_stream_msg_t* bs_session_slot(const block_stream_msg_t* msg)
+{
+    #if ON_BS_MAX_SESSIONS > 1
+    UInt8 i;
+    block_stream_msg_t* free_msg = NULL;
+
+    if(!msg || !msg->dst)
+    {
+        return NULL;
+    }
+
+    if(bs_msg.transfer_in_progress)
+    {
+        if(bs_sessions_conflict(&bs_msg, msg))
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        free_msg = &bs_msg;
+    }
+
+    for(i = 0; i < ON_BS_MAX_SESSIONS - 1; i++)
+    {
+        if(bs_sessions[i].msg.transfer_in_progress)
+        {
+            if(bs_sessions_conflict(&(bs_sessions[i].msg), msg))
+            {
+                return NULL;
+            }
+        }
+        else if(!free_msg)
+        {
+            free_msg = &(bs_sessions[i].msg);
+            bs_sessions[i].timers_active = 0;
+            bs_sessions[i].parked_time = get_tick_count();
+        }
+    }
+
+    if(free_msg == &bs_msg)
+    {
+        ont_set_timer(ONT_BS_TIMER, 0);
+    }
+    return free_msg;
+    #else
+    if(!msg || !msg->dst || bs_msg.transfer_in_progress)
+    {
+        return NULL;
+    }
+    ont_set_timer(ONT_BS_TIMER, 0);
+    return &bs_msg;
+    #endif
+}
+
+
 /*!
     \brief Calculates the estimated time for a block transfer to complete
     
@@ -4442,7 +5316,17 @@ static BOOL check_for_clr_channel(void)
     {
         ont_set_timer(ONT_CLR_CHANNEL_TIMER,
           MS_TO_TICK(ONE_NET_CLR_CHANNEL_TIME));
+        #ifndef ON_STATS
         return one_net_channel_is_clear();
+        #else
+        if(one_net_channel_is_clear())
+        {
+            return TRUE;
+        }
+        
+        on_stats.channel_busy++;
+        return FALSE;
+        #endif
     } // if it is time to check the channel //
 
     return FALSE;
@@ -4503,8 +5387,21 @@ static on_message_status_t rx_block_data(on_txn_t* txn, block_stream_msg_t* bs_m
     ack_nack->handle = ON_ACK_BLK_PKTS_RCVD;
     if(!block_get_index_sent(block_pkt->chunk_idx, bs_msg->bs.block.sent))
     {
-        msg_status = (*pkt_hdlr.block_data_hdlr)(txn, bs_msg, block_pkt,
-          ack_nack);
+        UInt8 len;
+        UInt8* data = block_buffer_data(bs_msg, block_pkt->byte_idx,
+          block_pkt->chunk_idx, &len);
+        if(data && block_pkt->chunk_idx < block_pkt->chunk_size)
+        {
+            // straight into the registered buffer.
+            one_net_memmove(data, block_pkt->data, len);
+            msg_status = ON_MSG_ACCEPT_PACKET;
+        }
+        else
+        {
+            msg_status = (*pkt_hdlr.block_data_hdlr)(txn, bs_msg, block_pkt,
+              ack_nack);
+            ON_STATS_STATUS(msg_status);
+        }
         switch(msg_status)
         {
             case ON_MSG_TERMINATE: case ON_MSG_ABORT:
@@ -4591,77 +5488,320 @@ static void terminate_bs_complete(block_stream_msg_t* bs_msg)
     bs_msg->bs_on_state = ON_LISTEN_FOR_DATA;
     bs_msg->transfer_in_progress = FALSE;
     bs_msg->use_saved_ack_nack = FALSE;
+    on_bs_set_buffer(bs_msg, NULL, 0, 0);
     #ifdef DATA_RATE_CHANNEL
     one_net_set_data_rate(ONE_NET_DATA_RATE_38_4);
     one_net_set_channel(on_base_param->channel);
     ont_set_timer(ONT_DATA_RATE_CHANNEL_TIMER, 0);
     #endif
 }
-#endif
 
 
-#ifdef STREAM_MESSAGES_ENABLED
-static on_message_status_t rx_stream_resp_pkt(on_txn_t* txn,
-  block_stream_msg_t* bs_msg, on_pkt_t* pkt, UInt8* raw_payload_bytes,
-  on_ack_nack_t* ack_nack)
+/*!
+    \brief Adapts the sender's pace to the losses in the chunk just finished.
+
+    If every packet in the chunk arrived the first time it was sent, the
+    chunk size grows by one and the fragment delay and chunk pause shrink by
+    a step.  If any were lost, the chunk size is halved and the delays are
+    doubled.  The chunk size stays between 1 and the size agreed on at setup,
+    which is the largest the recipient accepts.  The delays stay within
+    ON_BS_ADAPT_RANGE of the values agreed on at setup.
+
+    Only called by the sender, between chunks.
+
+    \param[in/out] bs_msg The block message in progress.
+
+    \return void
+*/
+static void adapt_block_rate(block_stream_msg_t* bs_msg)
 {
-    on_message_status_t status;
-    on_encoded_did_t* terminating_did = &bs_msg->dst->did;
-        
-    if(on_parse_response_pkt(pkt->raw_pid, raw_payload_bytes, ack_nack) !=
-      ONS_SUCCESS)
+    block_msg_t* block = &(bs_msg->bs.block);
+    UInt16 min_frag_dly = block->base_frag_dly / ON_BS_ADAPT_RANGE;
+    UInt16 min_chunk_pause = block->base_chunk_pause / ON_BS_ADAPT_RANGE;
+    UInt32 max_frag_dly = (UInt32) block->base_frag_dly * ON_BS_ADAPT_RANGE;
+    UInt32 max_chunk_pause = (UInt32) block->base_chunk_pause *
+      ON_BS_ADAPT_RANGE;
+
+    if(block->chunk_losses)
     {
-        return ON_MSG_IGNORE; // undecipherable
+        UInt32 frag_dly = 2 * (UInt32) bs_msg->frag_dly;
+        UInt32 chunk_pause = 2 * (UInt32) block->chunk_pause;
+
+        block->chunk_size /= 2;
+        if(block->chunk_size < 1)
+        {
+            block->chunk_size = 1;
+        }
+        if(frag_dly < 1)
+        {
+            frag_dly = 1;
+        }
+        bs_msg->frag_dly = (UInt16) (frag_dly > max_frag_dly ? max_frag_dly :
+          frag_dly);
+        block->chunk_pause = (UInt16) (chunk_pause > max_chunk_pause ?
+          max_chunk_pause : chunk_pause);
     }
-    
-    if(!nack_reason_is_fatal(ack_nack->nack_reason))
+    else
     {
-        terminating_did = NULL;
+        if(block->chunk_size < block->max_chunk_size)
+        {
+            (block->chunk_size)++;
+        }
+        bs_msg->frag_dly = (bs_msg->frag_dly > min_frag_dly +
+          ON_BS_FRAG_DLY_STEP_MS) ? bs_msg->frag_dly - ON_BS_FRAG_DLY_STEP_MS :
+          min_frag_dly;
+        block->chunk_pause = (block->chunk_pause > min_chunk_pause +
+          ON_BS_CHUNK_PAUSE_STEP_MS) ? block->chunk_pause -
+          ON_BS_CHUNK_PAUSE_STEP_MS : min_chunk_pause;
     }
-    
-    // send it up to the application code.
-    status = (*pkt_hdlr.stream_ack_nack_hdlr)(txn, bs_msg, pkt,
-      raw_payload_bytes, ack_nack);
-      
-    if(terminating_did)
+
+    block->chunk_losses = 0;
+}
+
+
+#if ON_BS_MAX_SESSIONS > 1
+/*!
+    \brief Checks whether two block / stream transfers can run side by side.
+
+    Only transfers this device is the source of can take turns.  They must
+    go to different devices, which must not be each other's repeaters nor
+    share repeaters, as far as is known.  Since the radio is shared, they
+    must also stay on the base channel and data rate.
+
+    \param[in] a A transfer in progress.
+    \param[in] b The new transfer.
+
+    \return TRUE if the transfers would get in each other's way.
+            FALSE if they can take turns.
+*/
+static BOOL bs_sessions_conflict(const block_stream_msg_t* a,
+  const block_stream_msg_t* b)
+{
+    #ifdef ONE_NET_MULTI_HOP
+    UInt8 i, j;
+    UInt8 hops, num_repeaters;
+    on_encoded_did_t repeaters[ON_MAX_HOPS_LIMIT];
+    #endif
+
+    if(a->src || !a->dst || on_encoded_did_equal(
+      (const on_encoded_did_t*) &(a->dst->did),
+      (const on_encoded_did_t*) &(b->dst->did)))
     {
-        status = ON_MSG_ABORT;
+        return TRUE;
     }
 
-    switch(status)
+    if(a->channel != on_base_param->channel || b->channel !=
+      on_base_param->channel || a->data_rate != ONE_NET_DATA_RATE_38_4 ||
+      b->data_rate != ONE_NET_DATA_RATE_38_4)
     {
-        case ON_MSG_ABORT: case ON_MSG_TIMEOUT: case ON_MSG_TERMINATE:
-          terminate_bs_msg(bs_msg, (const on_encoded_did_t*)terminating_did,
-          status, ack_nack);
-          return ON_MSG_TERMINATE;
-        case ON_MSG_IGNORE:
-          return ON_MSG_IGNORE;
-        #ifdef COMPILE_WO_WARNINGS
-        // add default case that does nothing for clean compile
-        default:
-            break;
-        #endif
+        return TRUE;
     }
 
-    // we got a response, so reset the data rate change timer to the
-    // timeout
-    #ifdef DATA_RATE_CHANNEL
-    ont_set_timer(ONT_DATA_RATE_CHANNEL_TIMER, MS_TO_TICK(bs_msg->timeout));
-    #endif
-    ont_set_timer(ONT_BS_TIMEOUT_TIMER, MS_TO_TICK(bs_msg->timeout));
-    switch(ack_nack->handle)
+    #ifdef ONE_NET_MULTI_HOP
+    if(!route_cache_repeaters((const on_encoded_did_t*) &(b->dst->did), &hops,
+      &num_repeaters, repeaters))
     {
-        case ON_ACK_SLOW_DOWN_TIME_MS:
-          bs_msg->frag_dly += ack_nack->payload->nack_time_ms;
-          break;
-        case ON_ACK_SPEED_UP_TIME_MS:
-          bs_msg->frag_dly += ack_nack->payload->nack_time_ms;
-          break;
-        case ON_ACK_PAUSE_TIME_MS:
-          pause_bs_msg(bs_msg, ack_nack->payload->nack_time_ms);
-          break;
-        default:
-        {
+        num_repeaters = 0;
+    }
+
+    for(i = 0; i < a->num_repeaters; i++)
+    {
+        if(on_encoded_did_equal((const on_encoded_did_t*) &(a->repeaters[i]),
+          (const on_encoded_did_t*) &(b->dst->did)))
+        {
+            return TRUE;
+        }
+        for(j = 0; j < num_repeaters; j++)
+        {
+            if(on_encoded_did_equal((const on_encoded_did_t*)
+              &(a->repeaters[i]), (const on_encoded_did_t*) &(repeaters[j])))
+            {
+                return TRUE;
+            }
+        }
+    }
+
+    for(j = 0; j < num_repeaters; j++)
+    {
+        if(on_encoded_did_equal((const on_encoded_did_t*) &(repeaters[j]),
+          (const on_encoded_did_t*) &(a->dst->did)))
+        {
+            return TRUE;
+        }
+    }
+    #endif
+
+    return FALSE;
+}
+
+
+/*!
+    \brief Gives parked block / stream transfers their turn.
+
+    Called while listening.  If bs_msg is free, the transfer parked longest
+    moves in.  If bs_msg holds a transfer this device sends and it is waiting
+    out a chunk pause, it swaps places with the transfer parked longest that
+    is ready to send.  The timers the transfers own go with them.
+
+    \return void
+*/
+static void bs_session_schedule(void)
+{
+    UInt8 i;
+    SInt8 next = -1;
+    tick_t time_now = get_tick_count();
+    on_bs_session_t* session;
+    tick_t timer_expire[ON_BS_SESSION_NUM_TIMERS];
+    UInt8 timers_active = 0;
+
+    if(bs_msg.transfer_in_progress && (bs_msg.src || bs_msg.bs_on_state !=
+      ON_BS_CHUNK_PAUSE || ont_inactive_or_expired(ONT_BS_TIMER)))
+    {
+        // bs_msg is not waiting, so let it go on.
+        return;
+    }
+
+    for(i = 0; i < ON_BS_MAX_SESSIONS - 1; i++)
+    {
+        session = &bs_sessions[i];
+        if(!session->msg.transfer_in_progress)
+        {
+            continue;
+        }
+
+        if(bs_msg.transfer_in_progress && (session->timers_active & 0x01) &&
+          (SInt32) (session->timer_expire[0] - time_now) > 0)
+        {
+            // still in its own chunk pause
+            continue;
+        }
+
+        if(next == -1 || (SInt32) (session->parked_time -
+          bs_sessions[next].parked_time) < 0)
+        {
+            next = i;
+        }
+    }
+
+    if(next == -1)
+    {
+        return;
+    }
+
+    session = &bs_sessions[next];
+    for(i = 0; i < ON_BS_SESSION_NUM_TIMERS; i++)
+    {
+        timer_expire[i] = 0;
+        if(bs_msg.transfer_in_progress && ont_active(bs_session_timers[i]))
+        {
+            timers_active |= (1 << i);
+            timer_expire[i] = time_now + ont_get_timer(bs_session_timers[i]);
+        }
+
+        if(session->timers_active & (1 << i))
+        {
+            ont_set_timer(bs_session_timers[i],
+              (SInt32) (session->timer_expire[i] - time_now) > 0 ?
+              session->timer_expire[i] - time_now : 0);
+        }
+        else if(i == 0)
+        {
+            // ready to go.
+            ont_set_timer(bs_session_timers[i], 0);
+        }
+        else
+        {
+            ont_stop_timer(bs_session_timers[i]);
+        }
+
+        session->timer_expire[i] = timer_expire[i];
+    }
+    session->timers_active = timers_active;
+    session->parked_time = time_now;
+
+    {
+        // swap the two.  There is no room for a third copy.
+        UInt8* a = (UInt8*) &bs_msg;
+        UInt8* b = (UInt8*) &(session->msg);
+        UInt8 temp;
+        UInt16 j;
+        for(j = 0; j < sizeof(block_stream_msg_t); j++)
+        {
+            temp = a[j];
+            a[j] = b[j];
+            b[j] = temp;
+        }
+    }
+    bs_msg.saved_ack_nack.payload = (ack_nack_payload_t*)
+      bs_msg.saved_ack_nack_payload_bytes;
+}
+#endif
+#endif
+
+
+#ifdef STREAM_MESSAGES_ENABLED
+static on_message_status_t rx_stream_resp_pkt(on_txn_t* txn,
+  block_stream_msg_t* bs_msg, on_pkt_t* pkt, UInt8* raw_payload_bytes,
+  on_ack_nack_t* ack_nack)
+{
+    on_message_status_t status;
+    on_encoded_did_t* terminating_did = &bs_msg->dst->did;
+        
+    if(on_parse_response_pkt(pkt->raw_pid, raw_payload_bytes, ack_nack) !=
+      ONS_SUCCESS)
+    {
+        return ON_MSG_IGNORE; // undecipherable
+    }
+    
+    if(!nack_reason_is_fatal(ack_nack->nack_reason))
+    {
+        terminating_did = NULL;
+    }
+    
+    // send it up to the application code.
+    status = (*pkt_hdlr.stream_ack_nack_hdlr)(txn, bs_msg, pkt,
+      raw_payload_bytes, ack_nack);
+    ON_STATS_STATUS(status);
+      
+    if(terminating_did)
+    {
+        status = ON_MSG_ABORT;
+    }
+
+    switch(status)
+    {
+        case ON_MSG_ABORT: case ON_MSG_TIMEOUT: case ON_MSG_TERMINATE:
+          terminate_bs_msg(bs_msg, (const on_encoded_did_t*)terminating_did,
+          status, ack_nack);
+          return ON_MSG_TERMINATE;
+        case ON_MSG_IGNORE:
+          return ON_MSG_IGNORE;
+        #ifdef COMPILE_WO_WARNINGS
+        // add default case that does nothing for clean compile
+        default:
+            break;
+        #endif
+    }
+
+    // we got a response, so reset the data rate change timer to the
+    // timeout
+    #ifdef DATA_RATE_CHANNEL
+    ont_set_timer(ONT_DATA_RATE_CHANNEL_TIMER, MS_TO_TICK(bs_msg->timeout));
+    #endif
+    ont_set_timer(ONT_BS_TIMEOUT_TIMER, MS_TO_TICK(bs_msg->timeout));
+    switch(ack_nack->handle)
+    {
+        case ON_ACK_SLOW_DOWN_TIME_MS:
+          bs_msg->frag_dly += ack_nack->payload->nack_time_ms;
+          break;
+        case ON_ACK_SPEED_UP_TIME_MS:
+          bs_msg->frag_dly += ack_nack->payload->nack_time_ms;
+          break;
+        case ON_ACK_PAUSE_TIME_MS:
+          pause_bs_msg(bs_msg, ack_nack->payload->nack_time_ms);
+          break;
+        default:
+        {
             switch(ack_nack->nack_reason)
             {
                 case ON_NACK_RSN_INVALID_FRAG_DELAY:
@@ -4719,8 +5859,22 @@ static on_message_status_t rx_stream_data(on_txn_t* txn, block_stream_msg_t* bs_
       
     ack_nack->nack_reason = ON_NACK_RSN_NO_ERROR;
     ack_nack->handle = ON_NACK_VALUE;
-    msg_status = (*pkt_hdlr.stream_data_hdlr)(txn, bs_msg, stream_pkt,
-      ack_nack);
+    {
+        UInt8 len;
+        UInt8* data = stream_buffer_next(bs_msg, &len);
+        if(data)
+        {
+            // straight into the registered buffer.
+            one_net_memmove(data, stream_pkt->data, len);
+            msg_status = ON_MSG_ACCEPT_PACKET;
+        }
+        else
+        {
+            msg_status = (*pkt_hdlr.stream_data_hdlr)(txn, bs_msg,
+              stream_pkt, ack_nack);
+            ON_STATS_STATUS(msg_status);
+        }
+    }
     
     switch(msg_status)
     {
@@ -4744,6 +5898,572 @@ bs_build_terminate_ack:
 #endif
 
 
+/*!
+    \brief Adds a timed response to a device's response time estimate.
+
+    Keeps a smoothed response time and its mean deviation, with gains of 1/8
+    and 1/4 (Jacobson / Karels).  Multi-hop response times are divided by
+    the number of legs so the estimate stays per hop.
+
+    \param[in] txn The transaction that was responded to.  Its device's
+      estimate is updated.
+    \param[in] response_ms The time from sending the data packet to getting
+      the response, in ms.
+
+    \return void
+*/
+static void update_response_time(const on_txn_t* txn, UInt32 response_ms)
+{
+    SInt16 err;
+    on_sending_device_ram_t* ram = txn->device ?
+      (*get_sender_ram)(txn->device) : NULL;
+
+    if(!ram)
+    {
+        return;
+    }
+
+    #ifdef ONE_NET_MULTI_HOP
+    response_ms /= (1 + txn->max_hops);
+    #endif
+
+    if(response_ms > 0x7FFF)
+    {
+        response_ms = 0x7FFF;
+    }
+    else if(response_ms == 0)
+    {
+        response_ms = 1;
+    }
+
+    if(!ram->srtt)
+    {
+        // first time.
+        ram->srtt = (UInt16) response_ms;
+        ram->rttvar = (UInt16) response_ms / 2;
+        return;
+    }
+
+    err = (SInt16) response_ms - (SInt16) ram->srtt;
+    ram->srtt = (UInt16) ((SInt16) ram->srtt + err / 8);
+    if(!ram->srtt)
+    {
+        ram->srtt = 1;
+    }
+
+    if(err < 0)
+    {
+        err = -err;
+    }
+    ram->rttvar = (UInt16) ((SInt16) ram->rttvar +
+      (err - (SInt16) ram->rttvar) / 4);
+}
+
+
+#ifdef ON_PARK_SINGLE_TXNS
+/*!
+    \brief Sets aside the current single transaction until its retry is due.
+
+    The radio is otherwise idle until a transaction that got no response is
+    retried, so if a message to another device is ready, the transaction is
+    parked and that message goes first.  Transactions whose recipient list
+    belongs to the application code are not parked.
+
+    \param[in] pause_ms The time, in ms, to wait before the retry
+    \param[in] at_least_one_response TRUE if any recipient has responded
+
+    \return TRUE if the transaction was parked.  single_txn is then free.
+            FALSE if it was not.
+*/
+static BOOL park_single_txn(UInt32 pause_ms, BOOL at_least_one_response)
+{
+    UInt8 i;
+    int index;
+    tick_t next_pop_time;
+    on_parked_txn_t* parked = NULL;
+
+    if(!single_txn.device || (recipient_send_list_ptr &&
+      recipient_send_list_ptr != &recipient_send_list))
+    {
+        return FALSE;
+    }
+
+    for(i = 0; i < ON_SINGLE_TXN_WINDOW - 1; i++)
+    {
+        if(parked_txns[i].txn.priority == ONE_NET_NO_PRIORITY)
+        {
+            parked = &parked_txns[i];
+            break;
+        }
+    }
+
+    if(!parked)
+    {
+        return FALSE; // no room
+    }
+
+    // only worth it if something for another device is ready to go.
+    index = single_data_queue_ready_to_send(&next_pop_time);
+    if(index < 0 || on_encoded_did_equal(single_data_queue_dst((UInt8) index),
+      (const on_encoded_did_t* const) &(single_txn.device->did)))
+    {
+        return FALSE;
+    }
+
+    one_net_memmove(&(parked->txn), &single_txn, sizeof(on_txn_t));
+    one_net_memmove(parked->did, single_txn.device->did, ON_ENCODED_DID_LEN);
+    one_net_memmove(&(parked->msg), &single_msg, sizeof(on_single_data_queue_t));
+    one_net_memmove(parked->pld, single_msg.payload, single_msg.payload_size);
+    one_net_memmove(parked->pkt, single_txn.pkt, ON_MAX_ENCODED_DATA_PKT_SIZE);
+    parked->has_recipients = (recipient_send_list_ptr != NULL);
+    if(parked->has_recipients)
+    {
+        one_net_memmove(&(parked->recipients), &recipient_send_list,
+          sizeof(on_recipient_list_t));
+    }
+    parked->sends = single_txn_sends;
+    parked->at_least_one_response = at_least_one_response;
+    
+    if(pause_ms < single_txn.response_timeout)
+    {
+        pause_ms = single_txn.response_timeout;
+    }
+    parked->retry_time = get_tick_count() + MS_TO_TICK(pause_ms);
+
+    single_txn.priority = ONE_NET_NO_PRIORITY;
+    single_msg_ptr = NULL;
+    recipient_send_list_ptr = NULL;
+    return TRUE;
+}
+
+
+/*!
+    \brief Puts a parked single transaction back in single_txn.
+
+    A parked transaction to the device the next queued message is to goes
+    first so that the device's messages stay in order.  Otherwise the one
+    whose retry has been due longest goes.  The packet is rebuilt since the
+    device's message ID may have changed while it was parked.
+
+    \param[in] index The index of the next queued message that is ready to
+      send, or -1 if there is none
+    \param[out] at_least_one_response Set to whether any recipient of the
+      resumed message has responded
+
+    \return TRUE if a transaction was resumed.  It is ready to send.
+            FALSE if none was.
+*/
+static BOOL resume_single_txn(int index, BOOL* const at_least_one_response)
+{
+    UInt8 i;
+    on_parked_txn_t* parked = NULL;
+    tick_t time_now = get_tick_count();
+
+    for(i = 0; i < ON_SINGLE_TXN_WINDOW - 1; i++)
+    {
+        on_parked_txn_t* candidate = &parked_txns[i];
+        if(candidate->txn.priority == ONE_NET_NO_PRIORITY)
+        {
+            continue;
+        }
+
+        if(index >= 0 && on_encoded_did_equal(
+          single_data_queue_dst((UInt8) index),
+          (const on_encoded_did_t* const) &(candidate->did)))
+        {
+            parked = candidate;
+            break;
+        }
+
+        if(time_now >= candidate->retry_time && (!parked ||
+          candidate->retry_time < parked->retry_time))
+        {
+            parked = candidate;
+        }
+    }
+
+    if(!parked)
+    {
+        return FALSE;
+    }
+
+    one_net_memmove(&single_txn, &(parked->txn), sizeof(on_txn_t));
+    parked->txn.priority = ONE_NET_NO_PRIORITY;
+    one_net_memmove(&single_msg, &(parked->msg), sizeof(on_single_data_queue_t));
+    single_msg.payload = single_data_raw_pld;
+    one_net_memmove(single_msg.payload, parked->pld, single_msg.payload_size);
+    one_net_memmove(single_txn.pkt, parked->pkt, ON_MAX_ENCODED_DATA_PKT_SIZE);
+    if(parked->has_recipients)
+    {
+        one_net_memmove(&recipient_send_list, &(parked->recipients),
+          sizeof(on_recipient_list_t));
+        recipient_send_list_ptr = &recipient_send_list;
+    }
+    else
+    {
+        recipient_send_list_ptr = NULL;
+    }
+    single_txn_sends = parked->sends;
+    *at_least_one_response = parked->at_least_one_response;
+
+    #ifdef ONE_NET_MULTI_HOP
+    // data_pkt_ptrs may have been used for other devices' messages while
+    // this one was parked, and the hops field is built from it.
+    data_pkt_ptrs.hops = single_txn.hops;
+    data_pkt_ptrs.max_hops = single_txn.max_hops;
+    #endif
+
+    if(!on_encoded_did_equal((const on_encoded_did_t* const) &(parked->did),
+      (const on_encoded_did_t* const) &(single_txn.device->did)))
+    {
+        // the device's entry was reused while the transaction was parked.
+        single_txn.device = (*get_sender_info)(
+          (const on_encoded_did_t* const) &(parked->did));
+        if(!single_txn.device)
+        {
+            drop_resumed_single_txn(ON_MSG_FAIL);
+            return FALSE;
+        }
+    }
+
+    if(!setup_pkt_ptr(single_msg.raw_pid, single_txn.pkt,
+      single_txn.device->msg_id, &data_pkt_ptrs) ||
+      #ifndef BLOCK_MESSAGES_ENABLED
+      on_build_data_pkt(single_msg.payload, single_msg.msg_type,
+      &data_pkt_ptrs, &single_txn) != ONS_SUCCESS ||
+      #else
+      on_build_data_pkt(single_msg.payload, single_msg.msg_type,
+      &data_pkt_ptrs, &single_txn, NULL) != ONS_SUCCESS ||
+      #endif
+      on_complete_pkt_build(&data_pkt_ptrs, single_msg.raw_pid) !=
+      ONS_SUCCESS)
+    {
+        drop_resumed_single_txn(ON_MSG_INTERNAL_ERR);
+        return FALSE;
+    }
+
+    one_net_memmove(expected_src_did,
+      &(data_pkt_ptrs.packet_bytes[ON_ENCODED_DST_DID_IDX]),
+      ON_ENCODED_DID_LEN);
+    single_msg_ptr = &single_msg;
+    ont_set_timer(single_txn.next_txn_timer, 0);
+    on_state = ON_SEND_SINGLE_DATA_PKT;
+    return TRUE;
+}
+
+
+/*!
+    \brief Gives up on a parked single transaction that could not be resumed.
+
+    The single transaction handler is told the message failed, the same as
+    when it runs out of retries, so that the application hears about it.
+
+    \param[in] status The status to report.
+
+    \return void
+*/
+static void drop_resumed_single_txn(on_message_status_t status)
+{
+    on_txn_t* txn = &single_txn;
+    on_ack_nack_t ack_nack;
+    ack_nack_payload_t ack_nack_payload;
+
+    ack_nack.payload = &ack_nack_payload;
+    ack_nack.handle = ON_NACK;
+    ack_nack.nack_reason = ON_NACK_RSN_INTERNAL_ERR;
+
+    // the packet still has its destination, which the handler needs.
+    if(setup_pkt_ptr(single_msg.raw_pid, single_txn.pkt, single_txn.device ?
+      single_txn.device->msg_id : 0, &data_pkt_ptrs))
+    {
+        (*pkt_hdlr.single_txn_hdlr)(&txn, &data_pkt_ptrs, single_msg.payload,
+          &(single_msg.msg_type), status, &ack_nack);
+    }
+
+    single_txn.priority = ONE_NET_NO_PRIORITY;
+    single_msg_ptr = NULL;
+    recipient_send_list_ptr = NULL;
+}
+#endif
+
+
+#ifdef ONE_NET_MULTI_HOP
+/*!
+    \brief Finds the route cache entry for a destination.
+
+    Entries that have not been seen working for ON_ROUTE_CACHE_TIMEOUT_MS are
+    dropped when they are found.
+
+    \param[in] dst The destination.
+
+    \return The destination's entry.
+            NULL if there is none or it has aged out.
+*/
+static on_route_cache_entry_t* route_cache_entry(
+  const on_encoded_did_t* const dst)
+{
+    UInt8 i;
+
+    if(!dst || is_broadcast_did(dst))
+    {
+        return NULL;
+    }
+
+    for(i = 0; i < ON_ROUTE_CACHE_SIZE; i++)
+    {
+        if(on_encoded_did_equal(dst,
+          (const on_encoded_did_t*) &(route_cache[i].did)))
+        {
+            if(get_tick_count() - route_cache[i].seen_time >
+              MS_TO_TICK(ON_ROUTE_CACHE_TIMEOUT_MS))
+            {
+                one_net_memmove(route_cache[i].did, ON_ENCODED_BROADCAST_DID,
+                  ON_ENCODED_DID_LEN);
+                return NULL;
+            }
+            return &route_cache[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*!
+    \brief Classifies the addresses in a received packet's header.
+
+    The DIDs this device compares against are loaded once as 16-bit words,
+    then each address in the header is compared against them a word at a
+    time.
+
+    \param[in] pkt_bytes The encoded packet.  Only the header is looked at.
+
+    \return The ON_RX_... bits of the addresses that match
+*/
+static UInt8 classify_rx_addresses(const UInt8* const pkt_bytes)
+{
+    const UInt16 dst = ON_DID_WORD(&pkt_bytes[ON_ENCODED_DST_DID_IDX]);
+    const UInt16 src = ON_DID_WORD(&pkt_bytes[ON_ENCODED_SRC_DID_IDX]);
+    const UInt16 me = ON_DID_WORD(&(on_base_param->sid[ON_ENCODED_NID_LEN]));
+    const UInt16 broadcast = ON_DID_WORD(ON_ENCODED_BROADCAST_DID);
+    const UInt16 master = ON_DID_WORD(MASTER_ENCODED_DID);
+    const UInt16 expected = ON_DID_WORD(expected_src_did);
+    UInt8 addresses = 0;
+    
+    if(dst == me)
+    {
+        addresses |= ON_RX_DST_ME;
+    }
+    if(dst == broadcast)
+    {
+        addresses |= ON_RX_DST_BROADCAST;
+    }
+    if(dst == master)
+    {
+        addresses |= ON_RX_DST_MASTER;
+    }
+    if(src == me)
+    {
+        addresses |= ON_RX_SRC_ME;
+    }
+    if(src == master)
+    {
+        addresses |= ON_RX_SRC_MASTER;
+    }
+    if(expected == broadcast || src == expected)
+    {
+        addresses |= ON_RX_SRC_EXPECTED;
+    }
+    
+    #ifdef BLOCK_MESSAGES_ENABLED
+    {
+        // note that these values might be garbage if we are not in the
+        // middle of a block / stream transfer.  It's OK if they are because
+        // the values will only be used if we are in a block / stream transfer.
+        const UInt16 bs_src = ON_DID_WORD(
+          *get_encoded_did_from_sending_device(bs_msg.src));
+        const UInt16 bs_dst = ON_DID_WORD(
+          *get_encoded_did_from_sending_device(bs_msg.dst));
+        
+        if(src == bs_src || src == bs_dst)
+        {
+            addresses |= ON_RX_SRC_BS_ENDPOINT;
+        }
+        if(dst == bs_src || dst == bs_dst)
+        {
+            addresses |= ON_RX_DST_BS_ENDPOINT;
+        }
+    }
+    #endif
+    
+    return addresses;
+}
+
+
+#ifdef ONE_NET_MH_CLIENT_REPEATER
+/*!
+    \brief Checks whether a packet about to be repeated was repeated already.
+
+    Copies of a packet reach a repeater over every path the packet takes
+    through the network.  The first copy is repeated and remembered.  Later
+    copies are recognized until the time it could take the last copy to
+    arrive has passed.  That is kept shorter than the time the sender waits
+    before it resends, so a resend is repeated like any new packet.
+
+    A packet is identified by its header, minus the repeater and the hops,
+    and its payload.  Both are still encoded and encrypted, so the message
+    id and the source are covered.
+
+    \param[in] pkt The packet to be repeated, hops not yet incremented.
+
+    \return TRUE if the packet was repeated already and should be dropped.
+            FALSE if it has not been.  It is now remembered.
+*/
+static BOOL mh_already_repeated(const on_pkt_t* const pkt)
+{
+    on_mh_dup_entry_t* entry;
+    UInt16 tag;
+    tick_t time_now = get_tick_count();
+
+    tag = (one_net_compute_crc(&(pkt->packet_bytes[ON_ENCODED_MSG_CRC_IDX]),
+      ON_ENCODED_PLD_IDX - ON_ENCODED_MSG_CRC_IDX, ON_PLD_INIT_CRC,
+      ON_PLD_CRC_ORDER) << 8) | (UInt8) one_net_compute_crc(
+      &(pkt->packet_bytes[ON_ENCODED_PLD_IDX]), pkt->payload_len,
+      ON_PLD_INIT_CRC, ON_PLD_CRC_ORDER);
+    entry = &mh_dup_cache[tag % ON_MH_DUP_CACHE_SIZE];
+
+    if(entry->expire_time && time_now < entry->expire_time)
+    {
+        if(entry->tag == tag)
+        {
+            mh_dup_stats.hits++;
+            return TRUE;
+        }
+
+        // another packet is still in its window, but the newer one is
+        // more likely to come around again.
+        mh_dup_stats.evictions++;
+    }
+
+    // The sender waits at least a response timeout per hop, plus the
+    // repeater latencies, before it resends.
+    entry->tag = tag;
+    entry->expire_time = time_now + MS_TO_TICK(pkt->max_hops *
+      (ONE_NET_MH_LATENCY + ON_MIN_RESPONSE_TIME_OUT));
+    return FALSE;
+}
+#endif
+
+
+#ifdef ROUTE
+/*!
+    \brief Adds the route from a route message response to the route cache.
+
+    \param[in] dst The device the route message was sent to.
+    \param[in] route The route from the response.  Not changed.
+
+    \return void
+*/
+static void learn_route(const on_encoded_did_t* const dst,
+  const UInt8* const route)
+{
+    UInt8 route_copy[ONA_EXTENDED_SINGLE_PACKET_PAYLOAD_LEN];
+    UInt8 hops, return_hops, num_repeaters;
+    on_encoded_did_t repeaters[ON_MAX_HOPS_LIMIT];
+
+    // extracting may add to the route, so work on a copy.
+    one_net_memmove(route_copy, route, sizeof(route_copy));
+    if(extract_repeaters_and_hops_from_route(dst, route_copy, &hops,
+      &return_hops, &num_repeaters, repeaters))
+    {
+        route_cache_add(dst, hops > return_hops ? hops : return_hops,
+          num_repeaters, (const on_encoded_did_t*) repeaters);
+    }
+}
+#endif
+#endif
+
+
+
+#ifdef ON_MSG_ID_WINDOW
+/*!
+    \brief Determines whether a message id older than the current one for a
+           device can still be accepted.
+
+    A message id can be accepted if it is within ON_MSG_ID_WINDOW_SIZE of
+    the device's current message id and has not been received before.
+
+    \param[in] device The device the message came from.
+    \param[in] msg_id The message id of the message.
+
+    \return TRUE if the message id has not been seen and is in the window.
+            FALSE otherwise.
+*/
+static BOOL msg_id_in_window(const on_sending_device_t* const device,
+  UInt16 msg_id)
+{
+    UInt16 age;
+    const on_sending_device_ram_t* ram = (*get_sender_ram)(device);
+
+    if(!ram || !ram->rx_msg_id_window || msg_id >= device->msg_id ||
+      device->msg_id - msg_id >= ON_MSG_ID_WINDOW_SIZE)
+    {
+        return FALSE;
+    }
+
+    if(msg_id > ram->rx_msg_id_top)
+    {
+        // newer than anything received.  The message id has moved since
+        // because of messages sent to this device.
+        return TRUE;
+    }
+
+    age = ram->rx_msg_id_top - msg_id;
+    return (age < ON_MSG_ID_WINDOW_SIZE &&
+      !(ram->rx_msg_id_window & (((UInt32) 1) << age)));
+}
+
+
+/*!
+    \brief Records that a message id has been received from a device.
+
+    \param[in/out] device The device the message came from.
+    \param[in] msg_id The message id of the message.
+
+    \return void
+*/
+static void msg_id_window_mark(on_sending_device_t* const device,
+  UInt16 msg_id)
+{
+    on_sending_device_ram_t* ram = (*get_sender_ram)(device);
+
+    if(!ram)
+    {
+        return;
+    }
+
+    if(ram->rx_msg_id_window && msg_id > ram->rx_msg_id_top &&
+      msg_id - ram->rx_msg_id_top < ON_MSG_ID_WINDOW_SIZE)
+    {
+        ram->rx_msg_id_window = (ram->rx_msg_id_window <<
+          (msg_id - ram->rx_msg_id_top)) | 1;
+        ram->rx_msg_id_top = msg_id;
+    }
+    else if(ram->rx_msg_id_window && msg_id <= ram->rx_msg_id_top &&
+      ram->rx_msg_id_top - msg_id < ON_MSG_ID_WINDOW_SIZE)
+    {
+        ram->rx_msg_id_window |= (((UInt32) 1) <<
+          (ram->rx_msg_id_top - msg_id));
+    }
+    else
+    {
+        // too far from anything remembered.  Start over.
+        ram->rx_msg_id_window = 1;
+        ram->rx_msg_id_top = msg_id;
+    }
+}
+#endif
+
 
 //! @} ONE-NET_pri_func
 //                      PRIVATE FUNCTION IMPLEMENTATION END
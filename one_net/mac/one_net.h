@@ -151,6 +151,10 @@ enum
 
     //! The number of hops to try when sending the first Multi-Hop packet
     ON_FIRST_MH_MAX_HOPS_COUNT = 2,
+
+    //! num_repeaters value for a route cache entry whose hop count is known
+    //! but whose repeaters are not
+    ON_ROUTE_REPEATERS_UNKNOWN = 0xFF,
     #endif
 };
 
@@ -171,6 +175,33 @@ extern const on_encoded_did_t MASTER_ENCODED_DID;
 //! All transfer sizes <= 2000 bytes are considered "short"
 #define ON_SHORT_BLOCK_TRANSFER_MAX_SIZE 2000
 
+//! Number of single transactions to different devices that can be under way
+//! at once.  Only one is on the air.  The rest are waiting to retry after
+//! getting no response.
+#ifndef ON_SINGLE_TXN_WINDOW
+#define ON_SINGLE_TXN_WINDOW 1
+#endif
+
+#ifdef BLOCK_MESSAGES_ENABLED
+//! Number of block / stream transfers this device can be the source of at
+//! once.  The one being worked on is in bs_msg.  The others are parked and
+//! take turns with it during its chunk pauses.
+#ifndef ON_BS_MAX_SESSIONS
+#define ON_BS_MAX_SESSIONS 1
+#endif
+#endif
+
+#ifdef ON_STATS
+//! Number of different states on_stats keeps time for.  States entered
+//! after the table is full are only counted in untracked_entries.
+#ifndef ON_STATS_MAX_STATES
+#define ON_STATS_MAX_STATES 24
+#endif
+
+//! Number of packet types on_stats counts, indexed by raw pid type
+#define ON_STATS_NUM_PIDS (ONE_NET_RAW_CLIENT_REQUEST_INVITE + 1)
+#endif
+
 
     
 //! @} ONE-NET_const
@@ -432,6 +463,11 @@ typedef on_sending_device_t* (*one_net_get_sender_info_func_t)
   (const on_encoded_did_t * const DID);;
 
 
+//! Function to retrieve the RAM-only information for a sending device
+typedef on_sending_device_ram_t* (*one_net_get_sender_ram_func_t)
+  (const on_sending_device_t* device);
+
+
 //! Packet Handling Function for data packets
 typedef on_message_status_t (*on_pkt_hdlr_t)(on_txn_t** txn,
   on_pkt_t* const pkt, UInt8* raw_pld, UInt8* msg_type,
@@ -519,6 +555,57 @@ typedef enum
 } dr_channel_stage_t;
 
 
+#ifdef ONE_NET_MH_CLIENT_REPEATER
+//! Counters for the repeater's duplicate suppression
+typedef struct
+{
+    UInt16 hits;      //!< copies not repeated because they already were
+    UInt16 evictions; //!< packets forgotten before their copies could arrive
+} on_mh_dup_stats_t;
+#endif
+
+
+#ifdef ON_STATS
+//! Time spent in one state
+typedef struct
+{
+    UInt8 state;    //!< the on_state_t value
+    UInt16 entries; //!< number of times the state was entered
+    tick_t ticks;   //!< total ticks spent in the state
+} on_state_stats_t;
+
+
+//! Counters for the ONE-NET state machine
+typedef struct
+{
+    //! The states seen so far, in the order they were first entered
+    on_state_stats_t state[ON_STATS_MAX_STATES];
+    
+    //! Number of entries used in state
+    UInt8 num_states;
+    
+    //! Entries into states that did not fit in state
+    UInt16 untracked_entries;
+    
+    //! Statuses returned by the packet handlers.  Application defined
+    //! statuses are counted in the last element.
+    UInt16 status[ON_NUM_MESSAGE_STATUS_CODES + 1];
+    
+    //! Number of times a packet was held back because the channel was busy
+    UInt16 channel_busy;
+    
+    //! Number of single transaction retries
+    UInt16 retries;
+    
+    //! Packets sent, by raw pid type
+    UInt16 tx_pid[ON_STATS_NUM_PIDS];
+    
+    //! Packets received, by raw pid type
+    UInt16 rx_pid[ON_STATS_NUM_PIDS];
+} on_stats_t;
+#endif
+
+
 //! @} ONE-NET_typedefs
 //                                  TYPEDEFS END
 //==============================================================================
@@ -552,6 +639,14 @@ extern BOOL pid_blocking_on;
 extern pid_block_t pid_block_info;
 #endif
 
+#ifdef ONE_NET_MH_CLIENT_REPEATER
+extern on_mh_dup_stats_t mh_dup_stats;
+#endif
+
+#ifdef ON_STATS
+extern on_stats_t on_stats;
+#endif
+
 
 //! An array that contains the number of of units of each type that this
 //! device supports.  If values are changed here, see ONE_NET_NUM_UNIT_TYPES &
@@ -579,6 +674,9 @@ extern on_pkt_t response_pkt_ptrs;
 //! a function to retrieve the sender information
 extern one_net_get_sender_info_func_t get_sender_info;
 
+//! Retrieves the RAM-only information for a sending device
+extern one_net_get_sender_ram_func_t get_sender_ram;
+
 
 //! A place to store a single message with payload.
 extern on_single_data_queue_t single_msg;
@@ -729,6 +827,23 @@ BOOL device_in_range(on_encoded_did_t* did);
 #endif
 
 
+#ifdef ONE_NET_MULTI_HOP
+void route_cache_add(const on_encoded_did_t* const dst, UInt8 hops,
+  UInt8 num_repeaters, const on_encoded_did_t* repeaters);
+SInt8 route_cache_hops(const on_encoded_did_t* const dst);
+BOOL route_cache_repeaters(const on_encoded_did_t* const dst, UInt8* hops,
+  UInt8* num_repeaters, on_encoded_did_t* repeaters);
+void route_cache_invalidate(const on_encoded_did_t* const dst);
+void route_cache_clear(void);
+#endif
+
+
+#ifdef ON_STATS
+void on_stats_update(void);
+void on_stats_reset(void);
+#endif
+
+
 #ifdef ROUTE
 one_net_status_t send_route_msg(const on_raw_did_t* raw_did);
 UInt16 extract_raw_did_from_route(const UInt8* route, UInt8 index);
@@ -754,8 +869,11 @@ BOOL new_key_fragment(const one_net_xtea_key_fragment_t* const fragment,
 
 BOOL one_net_reject_bad_msg_id(const on_sending_device_t* device);
 
+UInt16 one_net_device_response_timeout(const on_sending_device_t* device);
+
 
 #ifdef BLOCK_MESSAGES_ENABLED
+block_stream_msg_t* bs_session_slot(const block_stream_msg_t* msg);
 UInt32 estimate_block_transfer_time(const block_stream_msg_t* bs_msg);
 void adjust_bs_priority(block_stream_msg_t* msg, UInt8 priority);
 void adjust_bs_chunk_pause(block_stream_msg_t* msg, UInt16 chunk_pause);
@@ -75,6 +75,18 @@
 //! @{
 
 
+#ifndef ONE_NET_SIMPLE_CLIENT
+//! Number of slots in the sending device hash table.  A power of 2 at least
+//! twice ONE_NET_RX_FROM_DEVICE_COUNT so that probes stay short.
+enum
+{
+    ON_SENDING_DEV_HASH_SIZE = ONE_NET_RX_FROM_DEVICE_COUNT <= 4 ? 8 :
+      (ONE_NET_RX_FROM_DEVICE_COUNT <= 8 ? 16 :
+      (ONE_NET_RX_FROM_DEVICE_COUNT <= 16 ? 32 :
+      (ONE_NET_RX_FROM_DEVICE_COUNT <= 32 ? 64 : 256)))
+};
+#endif
+
 
 //! @} ONE-NET_CLIENT_const
 //                                  CONSTANTS END
@@ -146,11 +158,41 @@ on_master_t * const master
 //! to this device.
 on_sending_dev_list_item_t sending_dev_list[ONE_NET_RX_FROM_DEVICE_COUNT];
 
+#ifndef ONE_NET_SIMPLE_CLIENT
+//! Hit / miss counters for sending_dev_list
+on_sending_dev_stats_t sending_dev_stats;
+#endif
+
 //! Set to true upon being deleted from the network.  There will be a slight
 //! two second pause before this device actually removes itself to give any
 //! pending transactions to complete.
 static BOOL removed = FALSE;
 
+#ifndef ONE_NET_SIMPLE_CLIENT
+//! Index into sending_dev_list of each device on it, placed by the hash of
+//! its DID with linear probing.  ON_SENDING_DEV_NONE if empty.
+static UInt8 sending_dev_hash[ON_SENDING_DEV_HASH_SIZE];
+
+//! The most and least recently used devices on sending_dev_list
+static UInt8 sending_dev_newest;
+static UInt8 sending_dev_oldest;
+
+//! The first free slot of sending_dev_list.  The rest are chained through
+//! lru_older.
+static UInt8 sending_dev_free;
+#endif
+
+//! How long to wait before the next check-in, in ms, when it should not be
+//! a full keep-alive interval from now.  Set from the master's reply to a
+//! check-in.  0 if the keep-alive interval should be used.
+static UInt32 check_in_delay_ms = 0;
+
+//! The RAM-only information for the MASTER
+static on_sending_device_ram_t master_ram;
+
+//! The RAM-only information for each device, indexed like sending_dev_list
+static on_sending_device_ram_t sending_dev_ram[ONE_NET_RX_FROM_DEVICE_COUNT];
+
 
 
 //! @} ONE-NET_CLIENT_pri_var
@@ -200,8 +242,17 @@ static on_message_status_t on_client_single_txn_hdlr(on_txn_t ** txn,
 #ifndef ONE_NET_SIMPLE_CLIENT
 static on_sending_dev_list_item_t* get_sending_dev_list_item_t(
   const on_encoded_did_t* DID);
+static void sending_dev_list_init(void);
+static UInt8 sending_dev_hash_home(const on_encoded_did_t* const DID);
+static UInt8 sending_dev_find(const on_encoded_did_t* const DID,
+  UInt8* const pos);
+static void sending_dev_unlink(UInt8 index);
+static void sending_dev_make_newest(UInt8 index);
+static void sending_dev_remove(UInt8 index);
 #endif
 static on_sending_device_t * sender_info(const on_encoded_did_t * const DID);
+static on_sending_device_ram_t* sender_ram(
+  const on_sending_device_t* device);
 static one_net_status_t init_internal(void);
 #ifndef ONE_NET_SIMPLE_CLIENT
 static BOOL send_new_key_request(void);
@@ -221,6 +272,12 @@ static on_message_status_t handle_admin_pkt(const on_encoded_did_t * const
   SRC_DID, const UInt8 * const DATA, on_txn_t* txn, on_ack_nack_t* ack_nack);
   
 static BOOL check_in_with_master(void);
+static tick_t keep_alive_time(void);
+#if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+static tick_t next_wake_time(tick_t queue_sleep_time);
+#else
+static tick_t next_wake_time(void);
+#endif
 
 
 #ifndef ONE_NET_SIMPLE_CLIENT
@@ -377,6 +434,7 @@ void on_client_unlock_device_slideoff(const on_encoded_did_t* enc_did)
     master->device.msg_id = 0;
     master->device.data_rate = ONE_NET_DATA_RATE_38_4;
     master->device.features = FEATURES_UNKNOWN;
+    one_net_memset(&master_ram, 0, sizeof(master_ram));
     #ifdef ONE_NET_MULTI_HOP
     master->device.hops = 0;
     master->device.max_hops = ON_MAX_HOPS_LIMIT;
@@ -477,6 +535,7 @@ one_net_status_t one_net_client_init(const UInt8 * const param,
             return ONS_BAD_PARAM;
         }
         one_net_memmove(peer_storage, peer_param, PEER_STORAGE_SIZE_BYTES);
+        one_net_sort_peers(NULL);
     }
     #endif
 
@@ -636,42 +695,25 @@ tick_t one_net_client(void)
     {
         #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
         tick_t queue_sleep_time;
-        #endif
         
-        // this will be the absolute maximum -- this may be overridden.
-        sleep_time = ont_get_timer(ONT_KEEP_ALIVE_TIMER);
-    
-        #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
-        if(single_data_queue_ready_to_send(&queue_sleep_time) == -1)
+        if(single_data_queue_ready_to_send(&queue_sleep_time) != -1 ||
+          check_in_with_master())
         #else
-        if(single_data_queue_ready_to_send() == -1)
+        if(single_data_queue_ready_to_send() != -1 || check_in_with_master())
         #endif
         {
-            #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
-            if(queue_sleep_time > 0 && queue_sleep_time < sleep_time)
-            {
-                sleep_time = queue_sleep_time;
-            }
-            #endif
-            
-            if(check_in_with_master())
-            {
-                sleep_time = 0;
-            }
+            sleep_time = 0;
         }
         else
         {
-            sleep_time = 0;
+            #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+            sleep_time = next_wake_time(queue_sleep_time);
+            #else
+            sleep_time = next_wake_time();
+            #endif
         }
     }
     
-    #ifdef DEVICE_SLEEPS
-    if(ont_get_timer(ONT_KEEP_ALIVE_TIMER))
-    {
-        sleep_time = 0;
-    }
-    #endif
-    
     #ifdef NON_VOLATILE_MEMORY
     // if we're going to do anything soon, don't save since things might change
     // soon.
@@ -830,16 +872,18 @@ on_nack_rsn_t on_client_initiate_block_msg(block_stream_msg_t* msg,
   on_ack_nack_t* ack_nack)
 {
     on_nack_rsn_t* nr = &ack_nack->nack_reason;
+    block_stream_msg_t* session;
     ack_nack->handle = ON_ACK;
     *nr = ON_NACK_RSN_NO_ERROR;
     
-    if(bs_msg.transfer_in_progress)
+    if(!(session = bs_session_slot(msg)))
     {
         *nr = ON_NACK_RSN_BUSY;
     }
     else
     {
-        one_net_memmove(&bs_msg, msg, sizeof(block_stream_msg_t));  
+        one_net_memmove(session, msg, sizeof(block_stream_msg_t));  
+        session->transfer_in_progress = FALSE; // until checked
         
         if(!msg->dst)
         {
@@ -848,35 +892,34 @@ on_nack_rsn_t on_client_initiate_block_msg(block_stream_msg_t* msg,
         }
         
         if(!features_data_rate_capable(THIS_DEVICE_FEATURES,
-          bs_msg.data_rate))
+          session->data_rate))
         {
             *nr = ON_NACK_RSN_INVALID_DATA_RATE;
             return *nr;
         }        
         
-        if(features_known(bs_msg.dst->features))
+        if(features_known(session->dst->features))
         {
-            if(!features_block_capable(bs_msg.dst->features))
+            if(!features_block_capable(session->dst->features))
             {
                 *nr = ON_NACK_RSN_DEVICE_FUNCTION_ERR;
             }
         
-            if(!features_data_rate_capable(bs_msg.dst->features,
-              bs_msg.data_rate))
+            if(!features_data_rate_capable(session->dst->features,
+              session->data_rate))
             { 
                 *nr = ON_NACK_RSN_INVALID_DATA_RATE;
             }
         }
         
-        set_bs_transfer_type(&bs_msg.flags, ON_BLK_TRANSFER);
-        bs_msg.src = NULL;
-        bs_msg.bs_on_state = ON_LISTEN_FOR_DATA;
-        ont_set_timer(ONT_BS_TIMER, 0);
+        set_bs_transfer_type(&session->flags, ON_BLK_TRANSFER);
+        session->src = NULL;
+        session->bs_on_state = ON_LISTEN_FOR_DATA;
     }
     
     if(*nr == ON_NACK_RSN_NO_ERROR)
     {
-        bs_msg.transfer_in_progress = TRUE;
+        session->transfer_in_progress = TRUE;
     }
     return *nr;
 }
@@ -969,16 +1012,18 @@ on_nack_rsn_t on_client_initiate_stream_msg(block_stream_msg_t* msg,
   on_ack_nack_t* ack_nack)
 {
     on_nack_rsn_t* nr = &ack_nack->nack_reason;
+    block_stream_msg_t* session;
     ack_nack->handle = ON_ACK;
     *nr = ON_NACK_RSN_NO_ERROR;
     
-    if(bs_msg.transfer_in_progress)
+    if(!(session = bs_session_slot(msg)))
     {
         *nr = ON_NACK_RSN_BUSY;
     }
     else
     {
-        one_net_memmove(&bs_msg, msg, sizeof(block_stream_msg_t));  
+        one_net_memmove(session, msg, sizeof(block_stream_msg_t));  
+        session->transfer_in_progress = FALSE; // until checked
         
         if(!msg->dst)
         {
@@ -987,35 +1032,34 @@ on_nack_rsn_t on_client_initiate_stream_msg(block_stream_msg_t* msg,
         }
         
         if(!features_data_rate_capable(THIS_DEVICE_FEATURES,
-          bs_msg.data_rate))
+          session->data_rate))
         {
             *nr = ON_NACK_RSN_INVALID_DATA_RATE;
             return *nr;
         }        
         
-        if(features_known(bs_msg.dst->features))
+        if(features_known(session->dst->features))
         {
-            if(!features_stream_capable(bs_msg.dst->features))
+            if(!features_stream_capable(session->dst->features))
             {
                 *nr = ON_NACK_RSN_DEVICE_FUNCTION_ERR;
             }
         
-            if(!features_data_rate_capable(bs_msg.dst->features,
-              bs_msg.data_rate))
+            if(!features_data_rate_capable(session->dst->features,
+              session->data_rate))
             { 
                 *nr = ON_NACK_RSN_INVALID_DATA_RATE;
             }
         }
         
-        set_bs_transfer_type(&bs_msg.flags, ON_STREAM_TRANSFER);
-        bs_msg.src = NULL;
-        bs_msg.bs_on_state = ON_LISTEN_FOR_DATA;
-        ont_set_timer(ONT_BS_TIMER, 0);
+        set_bs_transfer_type(&session->flags, ON_STREAM_TRANSFER);
+        session->src = NULL;
+        session->bs_on_state = ON_LISTEN_FOR_DATA;
     }
     
     if(*nr == ON_NACK_RSN_NO_ERROR)
     {
-        bs_msg.transfer_in_progress = TRUE;
+        session->transfer_in_progress = TRUE;
     }
     return *nr;
 }
@@ -1057,14 +1101,12 @@ static on_message_status_t on_client_single_data_hdlr(
     BOOL stay_awake;
     on_message_status_t msg_status;
     on_msg_hdr_t msg_hdr;
-    on_raw_did_t raw_src_did, raw_repeater_did;
+    const on_raw_did_t* const raw_src_did =
+      (const on_raw_did_t*) &(pkt->raw_src_did);
+    const on_raw_did_t* const raw_repeater_did =
+      (const on_raw_did_t*) &(pkt->raw_rptr_did);
     UInt8 response_pid;
     on_sending_device_t* device;
-
-    on_decode(raw_src_did, &(pkt->packet_bytes[ON_ENCODED_SRC_DID_IDX]),
-      ON_ENCODED_DID_LEN);
-    on_decode(raw_repeater_did, &(pkt->packet_bytes[ON_ENCODED_RPTR_DID_IDX]),
-      ON_ENCODED_DID_LEN);
     
     msg_hdr.msg_type = *msg_type;
     msg_hdr.raw_pid = pkt->raw_pid;
@@ -1121,18 +1163,67 @@ static on_message_status_t on_client_single_data_hdlr(
         }
         #endif
         default:   
-            #ifndef ONE_NET_MULTI_HOP
-            msg_status = one_net_client_handle_single_pkt(
-              &raw_pld[ON_PLD_DATA_IDX], &msg_hdr, (const on_raw_did_t* const)
-              &raw_src_did, (const on_raw_did_t* const) &raw_repeater_did,
-              ack_nack);
-            #else
-            msg_status = one_net_client_handle_single_pkt(
-              &raw_pld[ON_PLD_DATA_IDX], &msg_hdr, (const on_raw_did_t* const)
-              &raw_src_did, (const on_raw_did_t* const) &raw_repeater_did,
-              ack_nack, (*txn)->hops, &((*txn)->max_hops));
+        {
+            UInt8* app_pld = &raw_pld[ON_PLD_DATA_IDX];
+            UInt8 num_msgs = 1;
+            UInt8 num_handled = 0;
+            
+            #ifdef EXTENDED_SINGLE
+            // several application messages sent together.  Give them to the
+            // application one at a time as if each came in by itself.
+            if(*msg_type == ON_COALESCED_APP_MSG)
+            {
+                num_msgs = app_pld[ON_COALESCED_COUNT_IDX];
+                // the messages must all fit in the data the pid says came
+                // in, not just in the largest single packet.
+                if(num_msgs == 0 || num_msgs > ON_MAX_COALESCED_MSGS ||
+                  ON_COALESCED_MSG_IDX + num_msgs *
+                  ONA_SINGLE_PACKET_PAYLOAD_LEN > get_num_payload_blocks(
+                  pkt->raw_pid) * ONE_NET_XTEA_BLOCK_SIZE - ON_PLD_DATA_IDX)
+                {
+                    ack_nack->nack_reason = ON_NACK_RSN_BAD_SIZE_ERROR;
+                    msg_status = ON_MSG_CONTINUE;
+                    break;
+                }
+                app_pld = &app_pld[ON_COALESCED_MSG_IDX];
+                msg_hdr.msg_type = ON_APP_MSG;
+            }
+            #endif
+            
+            do
+            {
+                #ifndef ONE_NET_MULTI_HOP
+                msg_status = one_net_client_handle_single_pkt(app_pld,
+                  &msg_hdr, raw_src_did, raw_repeater_did, ack_nack);
+                #else
+                msg_status = one_net_client_handle_single_pkt(app_pld,
+                  &msg_hdr, raw_src_did, raw_repeater_did, ack_nack,
+                  (*txn)->hops, &((*txn)->max_hops));
+                #endif
+                if(msg_status == ON_MSG_CONTINUE && !ack_nack->nack_reason)
+                {
+                    num_handled++;
+                }
+                app_pld += ONA_SINGLE_PACKET_PAYLOAD_LEN;
+            } while(--num_msgs && msg_status == ON_MSG_CONTINUE &&
+              !ack_nack->nack_reason);
+            
+            #ifdef EXTENDED_SINGLE
+            if(*msg_type == ON_COALESCED_APP_MSG && num_handled &&
+              msg_status == ON_MSG_CONTINUE)
+            {
+                // ACK the messages that were handled by count, with the
+                // reason the next one failed, if one did, above that.  A
+                // NACK would have the sender try again, and the ones that
+                // were handled would be handled twice.
+                ack_nack->payload->ack_value = (((UInt32)
+                  ack_nack->nack_reason) << 8) | num_handled;
+                ack_nack->handle = ON_ACK_VALUE;
+                ack_nack->nack_reason = ON_NACK_RSN_NO_ERROR;
+            }
             #endif
             break;
+        }
     }
 
 
@@ -1434,6 +1525,10 @@ static on_message_status_t on_client_single_txn_hdlr(on_txn_t ** txn,
 {
     on_msg_hdr_t msg_hdr;
     on_raw_did_t dst;
+    UInt8* app_pld = raw_pld;
+    UInt8 num_msgs = 1;
+    UInt8 num_acked, i;
+    on_message_status_t msg_status = status;
     
     msg_hdr.raw_pid = pkt->raw_pid;
     msg_hdr.msg_id = pkt->msg_id;
@@ -1471,7 +1566,7 @@ static on_message_status_t on_client_single_txn_hdlr(on_txn_t ** txn,
             #endif
             {
                 // success.  We'll check in immediately again.
-                master->keep_alive_interval = 1;
+                check_in_delay_ms = 1;
                 break;
             }
             
@@ -1519,7 +1614,7 @@ static on_message_status_t on_client_single_txn_hdlr(on_txn_t ** txn,
                 // experimentation is needed, but the random pause now seems
                 // more trouble than it's worth.  The comments above may be
                 // largely obsolete, but keeping them in anyway for now.
-                master->keep_alive_interval = 1;
+                check_in_delay_ms = 1;
                                
                 if(ack_nack->handle == ON_ACK_ADMIN_MSG)
                 {
@@ -1682,23 +1777,59 @@ static on_message_status_t on_client_single_txn_hdlr(on_txn_t ** txn,
                 }
                 
                 // No admin messages within the keep-alive response from
-                // the master.  We were sent a new interval.
-                master->keep_alive_interval = ack_nack->payload->ack_time_ms;
-                #ifdef AUTO_SAVE
-                save = TRUE;
-                #endif
+                // the master.  We were sent the time until our next
+                // check-in slot.  Our keep-alive interval is unchanged.
+                check_in_delay_ms = ack_nack->payload->ack_time_ms;
                 break;
             }
         }
     }
 
-    #ifndef ONE_NET_MULTI_HOP
-    one_net_client_single_txn_status(status, (*txn)->retry,
-      msg_hdr, raw_pld, (const on_raw_did_t*) &dst, ack_nack);
-    #else
-    one_net_client_single_txn_status(status, (*txn)->retry, msg_hdr, raw_pld,
-      (const on_raw_did_t*) &dst, ack_nack, pkt->hops);
+    num_acked = num_msgs;
+    #ifdef EXTENDED_SINGLE
+    // a coalesced message carried several ON_APP_MSGs.  Report on each one
+    // to the application as if it had been sent by itself.
+    if(*msg_type == ON_COALESCED_APP_MSG)
+    {
+        num_msgs = raw_pld[ON_COALESCED_COUNT_IDX];
+        num_acked = num_msgs;
+        app_pld = &raw_pld[ON_COALESCED_MSG_IDX];
+        msg_hdr.msg_type = ON_APP_MSG;
+        
+        // The ACK holds how many of the messages were handled.  The rest
+        // were not.
+        if(!ack_nack->nack_reason && ack_nack->handle == ON_ACK_VALUE &&
+          (UInt8) ack_nack->payload->ack_value < num_msgs)
+        {
+            num_acked = (UInt8) ack_nack->payload->ack_value;
+        }
+    }
     #endif
+
+    for(i = 0; i < num_msgs; i++)
+    {
+        if(i == num_acked)
+        {
+            // the reason this one failed is above the count.
+            msg_status = ON_MSG_FAIL;
+            ack_nack->nack_reason = (on_nack_rsn_t)
+              (ack_nack->payload->ack_value >> 8);
+            ack_nack->handle = ON_NACK;
+            if(!ack_nack->nack_reason)
+            {
+                ack_nack->nack_reason = ON_NACK_RSN_GENERAL_ERR;
+            }
+        }
+        
+        #ifndef ONE_NET_MULTI_HOP
+        one_net_client_single_txn_status(msg_status, (*txn)->retry, msg_hdr,
+          app_pld, (const on_raw_did_t*) &dst, ack_nack);
+        #else
+        one_net_client_single_txn_status(msg_status, (*txn)->retry, msg_hdr,
+          app_pld, (const on_raw_did_t*) &dst, ack_nack, pkt->hops);
+        #endif
+        app_pld += ONA_SINGLE_PACKET_PAYLOAD_LEN;
+    }
     
     #if defined(BLOCK_MESSAGES_ENABLED) && defined(ONE_NET_MULTI_HOP)
     if(bs_msg.transfer_in_progress)
@@ -1749,8 +1880,7 @@ static on_message_status_t on_client_single_txn_hdlr(on_txn_t ** txn,
         // regular updates
         if(master->keep_alive_interval > 0)
         {
-            ont_set_timer(ONT_KEEP_ALIVE_TIMER,
-              MS_TO_TICK(master->keep_alive_interval));
+            ont_set_timer(ONT_KEEP_ALIVE_TIMER, keep_alive_time());
         }
     }
     
@@ -1930,7 +2060,13 @@ static on_message_status_t on_client_stream_txn_hdlr(
 */
 static one_net_status_t init_internal(void)
 {
+    #ifndef ONE_NET_SIMPLE_CLIENT
+    sending_dev_list_init();
+    #else
     one_net_memset(sending_dev_list, 0, sizeof(sending_dev_list));
+    #endif
+    one_net_memset(&master_ram, 0, sizeof(master_ram));
+    one_net_memset(sending_dev_ram, 0, sizeof(sending_dev_ram));
     
     pkt_hdlr.single_data_hdlr = &on_client_single_data_hdlr;
     pkt_hdlr.single_ack_nack_hdlr =
@@ -1955,6 +2091,7 @@ static one_net_status_t init_internal(void)
     #endif
 
     get_sender_info = &sender_info;
+    get_sender_ram = &sender_ram;
     device_is_master = FALSE;
     one_net_init();
     return ONS_SUCCESS;
@@ -1964,27 +2101,196 @@ static one_net_status_t init_internal(void)
 #ifndef ONE_NET_SIMPLE_CLIENT
 static on_sending_dev_list_item_t* get_sending_dev_list_item_t(
   const on_encoded_did_t* DID)
+{
+    UInt8 pos;
+    UInt8 index = sending_dev_find(DID, &pos);
+    
+    return (index == ON_SENDING_DEV_NONE ? NULL : &sending_dev_list[index]);
+}
+
+
+/*!
+    \brief Empties the list of devices this device has heard from.
+
+    \return void
+*/
+static void sending_dev_list_init(void)
 {
     UInt8 i;
+    
+    one_net_memset(sending_dev_list, 0, sizeof(sending_dev_list));
+    one_net_memset(sending_dev_hash, ON_SENDING_DEV_NONE,
+      sizeof(sending_dev_hash));
+    one_net_memset(&sending_dev_stats, 0, sizeof(sending_dev_stats));
+    sending_dev_newest = ON_SENDING_DEV_NONE;
+    sending_dev_oldest = ON_SENDING_DEV_NONE;
+    
     for(i = 0; i < ONE_NET_RX_FROM_DEVICE_COUNT; i++)
     {
-        if(on_encoded_did_equal(DID,
-          (const on_encoded_did_t * const)
-          &(sending_dev_list[i].sender.did)))
+        sending_dev_list[i].lru_newer = ON_SENDING_DEV_NONE;
+        sending_dev_list[i].lru_older = (i + 1 < ONE_NET_RX_FROM_DEVICE_COUNT) ?
+          i + 1 : ON_SENDING_DEV_NONE;
+    }
+    sending_dev_free = 0;
+}
+
+
+/*!
+    \brief Gives the hash table slot where the search for a device starts.
+
+    \param[in] DID The device id.
+
+    \return The hash table slot.
+*/
+static UInt8 sending_dev_hash_home(const on_encoded_did_t* const DID)
+{
+    return (UInt8)((*DID)[0] * 31 + (*DID)[1]) &
+      (ON_SENDING_DEV_HASH_SIZE - 1);
+}
+
+
+/*!
+    \brief Looks a device up in the sending device hash table.
+
+    \param[in] DID The device id.
+    \param[out] pos The hash table slot the device is in or, if it is not
+      on the list, the empty slot it would go in.
+
+    \return The index of the device in sending_dev_list.
+            ON_SENDING_DEV_NONE if it is not on the list.
+*/
+static UInt8 sending_dev_find(const on_encoded_did_t* const DID,
+  UInt8* const pos)
+{
+    UInt8 index;
+    
+    *pos = sending_dev_hash_home(DID);
+    while((index = sending_dev_hash[*pos]) != ON_SENDING_DEV_NONE)
+    {
+        if(on_encoded_did_equal(DID, (const on_encoded_did_t * const)
+          &(sending_dev_list[index].sender.did)))
+        {
+            return index;
+        }
+        *pos = (*pos + 1) & (ON_SENDING_DEV_HASH_SIZE - 1);
+    }
+    
+    return ON_SENDING_DEV_NONE;
+}
+
+
+/*!
+    \brief Takes a device out of the lru list.
+
+    \param[in] index The device's index in sending_dev_list.
+
+    \return void
+*/
+static void sending_dev_unlink(UInt8 index)
+{
+    on_sending_dev_list_item_t* item = &sending_dev_list[index];
+    
+    if(item->lru_newer == ON_SENDING_DEV_NONE)
+    {
+        sending_dev_newest = item->lru_older;
+    }
+    else
+    {
+        sending_dev_list[item->lru_newer].lru_older = item->lru_older;
+    }
+    
+    if(item->lru_older == ON_SENDING_DEV_NONE)
+    {
+        sending_dev_oldest = item->lru_newer;
+    }
+    else
+    {
+        sending_dev_list[item->lru_older].lru_newer = item->lru_newer;
+    }
+}
+
+
+/*!
+    \brief Puts a device that is not on the lru list at the most recently
+           used end of it.
+
+    \param[in] index The device's index in sending_dev_list.
+
+    \return void
+*/
+static void sending_dev_make_newest(UInt8 index)
+{
+    sending_dev_list[index].lru_newer = ON_SENDING_DEV_NONE;
+    sending_dev_list[index].lru_older = sending_dev_newest;
+    if(sending_dev_newest == ON_SENDING_DEV_NONE)
+    {
+        sending_dev_oldest = index;
+    }
+    else
+    {
+        sending_dev_list[sending_dev_newest].lru_newer = index;
+    }
+    sending_dev_newest = index;
+}
+
+
+/*!
+    \brief Removes a device from the sending device list.
+
+    Devices after it in the same probe run are moved back so that every
+    device can still be found without markers for removed ones.
+
+    \param[in] index The device's index in sending_dev_list.
+
+    \return void
+*/
+static void sending_dev_remove(UInt8 index)
+{
+    UInt8 pos, next, home;
+    
+    if(sending_dev_find((const on_encoded_did_t* const)
+      &(sending_dev_list[index].sender.did), &pos) != index)
+    {
+        return; // not on the list
+    }
+    
+    next = pos;
+    while(1)
+    {
+        next = (next + 1) & (ON_SENDING_DEV_HASH_SIZE - 1);
+        if(sending_dev_hash[next] == ON_SENDING_DEV_NONE)
+        {
+            break;
+        }
+        
+        // move it back into the hole unless it would then come before the
+        // slot its search starts at.
+        home = sending_dev_hash_home((const on_encoded_did_t* const)
+          &(sending_dev_list[sending_dev_hash[next]].sender.did));
+        if(((next - home) & (ON_SENDING_DEV_HASH_SIZE - 1)) >=
+          ((next - pos) & (ON_SENDING_DEV_HASH_SIZE - 1)))
         {
-            return &sending_dev_list[i];
+            sending_dev_hash[pos] = sending_dev_hash[next];
+            pos = next;
         }
     }
-    return NULL;
+    sending_dev_hash[pos] = ON_SENDING_DEV_NONE;
+    
+    sending_dev_unlink(index);
+    one_net_memset(sending_dev_list[index].sender.did, 0,
+      sizeof(sending_dev_list[index].sender.did));
+    sending_dev_list[index].lru_newer = ON_SENDING_DEV_NONE;
+    sending_dev_list[index].lru_older = sending_dev_free;
+    sending_dev_free = index;
 }
 
 
 /*!
     \brief Finds the sender info (or a location for the sender info).
 
-    Loops through and finds the information for the sending device.  If the
-    device has not heard from the sender before, a new location shall be
-    returned.
+    Looks up the sending device.  If the device has not heard from the sender
+    before, a new location shall be returned.  If the list is full, the least
+    recently used device that is allowed to slide off is replaced.
 
     \param[in] DID The device id of the sender.
 
@@ -1993,11 +2299,8 @@ static on_sending_dev_list_item_t* get_sending_dev_list_item_t(
 */
 static on_sending_device_t * sender_info(const on_encoded_did_t * const DID)
 {
-    SInt8 i;
-    SInt8 vacant_index = -1;
-    SInt8 replace_index = -1;
-    SInt8 device_index = -1;
-    UInt8 device_lru = ONE_NET_RX_FROM_DEVICE_COUNT;
+    UInt8 pos;
+    UInt8 device_index;
 
     if(!DID)
     {
@@ -2010,81 +2313,59 @@ static on_sending_device_t * sender_info(const on_encoded_did_t * const DID)
         return &master->device;
     } // if the MASTER is the sender //
 
-
-
-    for(i = 0; i < ONE_NET_RX_FROM_DEVICE_COUNT; i++)
+    device_index = sending_dev_find(DID, &pos);
+    if(device_index != ON_SENDING_DEV_NONE)
     {
-        if(sending_dev_list[i].lru)
-        {
-            if(on_encoded_did_equal(DID,
-              (const on_encoded_did_t * const)
-              &(sending_dev_list[i].sender.did)))
-            {
-                device_index = i;
-                device_lru = sending_dev_list[i].lru;
-            }
-            else
-            {
-                if(sending_dev_list[i].slideoff == ON_DEVICE_ALLOW_SLIDEOFF)
-                {
-                    if(replace_index == -1 || sending_dev_list[i].lru >
-                      sending_dev_list[replace_index].lru)
-                    {
-                        replace_index = i;
-                    }
-                }
-            }
-        }
-        else
+        sending_dev_stats.hits++;
+        if(device_index != sending_dev_newest)
         {
-            vacant_index = i;
+            sending_dev_unlink(device_index);
+            sending_dev_make_newest(device_index);
         }
+        return &(sending_dev_list[device_index].sender);
     }
     
-    if(device_index == -1)
+    sending_dev_stats.misses++;
+    if(sending_dev_free == ON_SENDING_DEV_NONE)
     {
-        if(vacant_index != -1)
+        device_index = sending_dev_oldest;
+        while(device_index != ON_SENDING_DEV_NONE &&
+          sending_dev_list[device_index].slideoff != ON_DEVICE_ALLOW_SLIDEOFF)
         {
-            replace_index = vacant_index;
+            device_index = sending_dev_list[device_index].lru_newer;
         }
         
-        device_index = replace_index;
-        if(device_index == -1)
+        if(device_index == ON_SENDING_DEV_NONE)
         {
-            goto adjust_lru_list; // no room on list
+            return NULL; // no room on list
         }
         
-        one_net_memmove(sending_dev_list[device_index].sender.did, *DID,
-          sizeof(sending_dev_list[device_index].sender.did));
-        sending_dev_list[device_index].sender.features = FEATURES_UNKNOWN;
-        sending_dev_list[device_index].sender.msg_id =
-          one_net_prand(get_tick_count(), 50);
-        sending_dev_list[device_index].slideoff = ON_DEVICE_ALLOW_SLIDEOFF;
+        sending_dev_stats.evictions++;
+        sending_dev_remove(device_index);
         
-        #ifdef ONE_NET_MULTI_HOP
-        sending_dev_list[device_index].sender.hops = 0;
-        sending_dev_list[device_index].sender.max_hops = ON_MAX_HOPS_LIMIT;
-        #endif
+        // removing may have moved things in the hash table
+        sending_dev_find(DID, &pos);
     }
-    sending_dev_list[device_index].lru = 1;
     
-adjust_lru_list:
-    for(i = 0; i < ONE_NET_RX_FROM_DEVICE_COUNT; i++)
-    {
-        if(i == device_index || sending_dev_list[i].lru == 0)
-        {
-            continue;
-        }
-        if(sending_dev_list[i].lru < device_lru)
-        {
-            sending_dev_list[i].lru++;
-        }
-    }
-
-    if(device_index == -1)
-    {
-        return NULL;
-    }
+    device_index = sending_dev_free;
+    sending_dev_free = sending_dev_list[device_index].lru_older;
+    sending_dev_hash[pos] = device_index;
+    sending_dev_make_newest(device_index);
+        
+    one_net_memmove(sending_dev_list[device_index].sender.did, *DID,
+      sizeof(sending_dev_list[device_index].sender.did));
+    sending_dev_list[device_index].sender.features = FEATURES_UNKNOWN;
+    sending_dev_list[device_index].sender.msg_id =
+      one_net_prand(get_tick_count(), 50);
+    sending_dev_list[device_index].slideoff = ON_DEVICE_ALLOW_SLIDEOFF;
+    one_net_memset(&sending_dev_ram[device_index], 0,
+      sizeof(on_sending_device_ram_t));
+        
+    #ifdef ONE_NET_MULTI_HOP
+    sending_dev_list[device_index].sender.hops = 0;
+    sending_dev_list[device_index].sender.max_hops = ON_MAX_HOPS_LIMIT;
+    #endif
+    
     return &(sending_dev_list[device_index].sender);
 } // sender_info //
 #else
@@ -2139,6 +2420,8 @@ static on_sending_device_t * sender_info(const on_encoded_did_t * const DID)
         sending_dev_list[device_index].sender.features = FEATURES_UNKNOWN;
         sending_dev_list[device_index].sender.msg_id =
           one_net_prand(get_tick_count(), 50);
+        one_net_memset(&sending_dev_ram[device_index], 0,
+          sizeof(on_sending_device_ram_t));
     }
 
     return &(sending_dev_list[device_index].sender);
@@ -2146,6 +2429,41 @@ static on_sending_device_t * sender_info(const on_encoded_did_t * const DID)
 #endif
 
 
+/*!
+    \brief Finds the RAM-only information for a sending device.
+
+    \param[in] device The MASTER's device or a device on sending_dev_list.
+
+    \return The device's RAM-only information.
+            NULL if device is neither.
+*/
+static on_sending_device_ram_t* sender_ram(
+  const on_sending_device_t* device)
+{
+    const UInt8* first = (const UInt8*) &(sending_dev_list[0].sender);
+    UInt16 offset;
+
+    if(device == &(master->device))
+    {
+        return &master_ram;
+    }
+
+    if((const UInt8*) device < first || device >
+      &(sending_dev_list[ONE_NET_RX_FROM_DEVICE_COUNT - 1].sender))
+    {
+        return NULL;
+    }
+
+    offset = (UInt16) ((const UInt8*) device - first);
+    if(offset % sizeof(on_sending_dev_list_item_t))
+    {
+        return NULL;
+    }
+
+    return &sending_dev_ram[offset / sizeof(on_sending_dev_list_item_t)];
+}
+
+
 
 #if SINGLE_QUEUE_LEVEL > MED_SINGLE_QUEUE_LEVEL
 static one_net_status_t send_keep_alive(tick_t send_time_from_now,
@@ -2537,7 +2855,8 @@ static on_message_status_t handle_admin_pkt(const on_encoded_did_t * const
         {
             master->keep_alive_interval = one_net_byte_stream_to_uint32(
               &DATA[1]);
-            ont_set_timer(ONT_KEEP_ALIVE_TIMER, master->keep_alive_interval);
+            check_in_delay_ms = 0;
+            ont_set_timer(ONT_KEEP_ALIVE_TIMER, keep_alive_time());
             #ifdef AUTO_SAVE
             save = TRUE;
             #endif
@@ -2592,7 +2911,8 @@ static on_message_status_t handle_admin_pkt(const on_encoded_did_t * const
                     removed_did);
                 if(removed_item)
                 {
-                    removed_item->lru = 0;
+                    sending_dev_remove((UInt8) (removed_item -
+                      sending_dev_list));
                 }
                 #endif
 
@@ -2777,6 +3097,95 @@ static BOOL check_in_with_master(void)
 }
 
 
+/*!
+    \brief Calculates how long to wait before the next check-in.
+
+    This is check_in_delay_ms if the master gave us one, which places our
+    check-ins in our slot of the master's keep-alive interval, and the
+    keep-alive interval otherwise.  check_in_delay_ms is used up by this call.
+    If ONE_NET_KEEP_ALIVE_JITTER_MS is defined, a random time up to that long
+    is added as well so that CLIENTs which were started together do not stay
+    in step.  Delays shorter than the jitter, such as the immediate check-ins
+    while the master has updates for us, are left alone.
+
+    \return The number of ticks until the next check-in.
+*/
+static tick_t keep_alive_time(void)
+{
+    UInt32 delay_ms = check_in_delay_ms ? check_in_delay_ms :
+      master->keep_alive_interval;
+    
+    check_in_delay_ms = 0;
+    
+    #ifdef ONE_NET_KEEP_ALIVE_JITTER_MS
+    if(delay_ms > ONE_NET_KEEP_ALIVE_JITTER_MS)
+    {
+        return MS_TO_TICK(delay_ms + one_net_prand(get_tick_count(),
+          ONE_NET_KEEP_ALIVE_JITTER_MS));
+    }
+    #endif
+    
+    return MS_TO_TICK(delay_ms);
+}
+
+
+/*!
+    \brief Calculates how long the device can go without needing attention.
+
+    Gathers every deadline the client knows about into one wake time.  This
+    includes all running timers (keep-alive, block / stream pauses and
+    timeouts, data rate changes, application timers, etc.) and the next time a
+    message in the queue can be sent.  Only called when there is no
+    transaction in progress and nothing is ready to be sent.
+
+    \param[in] queue_sleep_time The number of ticks until the next message in
+      the queue can be sent, as reported by single_data_queue_ready_to_send.
+      0 if there is nothing in the queue.
+
+    \return The number of ticks until the device needs to wake up.  0 if the
+      device should not sleep at all.
+*/
+#if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+static tick_t next_wake_time(tick_t queue_sleep_time)
+#else
+static tick_t next_wake_time(void)
+#endif
+{
+    tick_t sleep_time;
+    
+    // If the keep-alive timer is not running, we are either not in the
+    // network or could not send the last check-in, so stay awake.
+    if(!ont_active(ONT_KEEP_ALIVE_TIMER))
+    {
+        return 0;
+    }
+    
+    #ifdef DEVICE_SLEEPS
+    // we were told to stay awake for a while.
+    if(!ont_inactive_or_expired(ONT_STAY_AWAKE_TIMER))
+    {
+        return 0;
+    }
+    #endif
+    
+    // nothing is running, or the only thing left is a keep-alive that is
+    // already due.
+    if(!ont_next_expiration(&sleep_time))
+    {
+        return 0;
+    }
+    
+    #if SINGLE_QUEUE_LEVEL > MIN_SINGLE_QUEUE_LEVEL
+    if(queue_sleep_time > 0 && queue_sleep_time < sleep_time)
+    {
+        sleep_time = queue_sleep_time;
+    }
+    #endif
+    
+    return sleep_time;
+}
+
+
 #ifndef ONE_NET_SIMPLE_CLIENT
 /*!
     \brief Allows for adjustment of the recipient list for a message
@@ -69,7 +69,6 @@
 //! @{
 
 
-
 //! @} ONE-NET_CLIENT_typedefs
 //                                  TYPEDEFS END
 //==============================================================================
@@ -93,6 +92,9 @@ extern on_master_t * const master;
 
 
 extern on_sending_dev_list_item_t sending_dev_list[];
+#ifndef ONE_NET_SIMPLE_CLIENT
+extern on_sending_dev_stats_t sending_dev_stats;
+#endif
 
 
 //! @} ONE-NET_CLIENT_pub_var
@@ -89,6 +89,34 @@
 #endif
 
 
+//! Value in client_index for a DID slot that has no CLIENT
+#define ON_CLIENT_INDEX_NONE 0xFFFF
+
+//! Number of bytes in a bitmap with one bit per CLIENT
+#define ON_CLIENT_BITMAP_SIZE ((ONE_NET_MASTER_MAX_CLIENTS + 7) / 8)
+
+//! Time in ms before an update is sent again to a CLIENT that has not
+//! answered.  Doubles with each retry, up to ON_UPDATE_MAX_BACKOFF_SHIFT
+//! times.
+#define ON_UPDATE_RETRY_MS 2500
+
+//! Most times the update retry time doubles
+#define ON_UPDATE_MAX_BACKOFF_SHIFT 3
+
+//! Most updates check_updates_in_progress queues in one call
+#define ON_UPDATE_PIPELINE 2
+
+//! Number of times a new key fragment is broadcast when the key changes
+#define ON_REKEY_BROADCASTS 2
+
+//! Time between key fragment broadcasts, in ms
+#define ON_REKEY_BROADCAST_INTERVAL_MS 1500
+
+//! Time, in ms, after a key change starts before the CLIENTs that have not
+//! confirmed the new key are sent it directly.
+#define ON_REKEY_ACTIVATION_MS 5000
+
+
 //! @} ONE-NET_MASTER_const
 //                                  CONSTANTS END
 //==============================================================================
@@ -195,6 +223,74 @@ static tick_t remove_device_start_time = 0;
 //! The time that the add device update started.
 static tick_t add_device_start_time = 0;
 
+/*!
+    Direct-mapped index from a CLIENT's DID slot to its position in
+    client_list.  The slot is (raw DID - ONE_NET_INITIAL_CLIENT_DID) /
+    ON_CLIENT_DID_INCREMENT.  The MASTER always assigns the lowest vacant
+    DID, so every DID it hands out has a slot.
+*/
+static UInt16 client_index[ONE_NET_MASTER_MAX_CLIENTS];
+
+//! Number of CLIENTs whose DID has no slot in client_index.  These can only
+//! come from parameters that were not created by this MASTER and are found
+//! by searching client_list.
+static UInt16 unindexed_client_count = 0;
+
+//! One bit per DID slot, set if a CLIENT has the DID for that slot
+static UInt8 did_slot_used[ON_CLIENT_BITMAP_SIZE];
+
+//! One bit per position in client_list, set if the position holds a CLIENT
+static UInt8 list_slot_used[ON_CLIENT_BITMAP_SIZE];
+
+//! Min-heap of the client_list positions of the CLIENTs that must check in,
+//! ordered by next_check_in_time.
+static UInt16 check_in_heap[ONE_NET_MASTER_MAX_CLIENTS];
+
+//! Position in check_in_heap of each client_list position, or
+//! ON_CLIENT_INDEX_NONE if the CLIENT is not in the heap.
+static UInt16 check_in_heap_pos[ONE_NET_MASTER_MAX_CLIENTS];
+
+//! Number of CLIENTs in check_in_heap
+static UInt16 check_in_heap_size = 0;
+
+//! client_list positions of the CLIENTs with an update (add device, remove
+//! device, or key change) still to be sent, in the order they were queued.
+//! CLIENTs taken out of the queue stay here until send_queued_updates next
+//! passes them.
+static UInt16 update_queue[ONE_NET_MASTER_MAX_CLIENTS];
+
+//! Number of entries in update_queue
+static UInt16 update_queue_len = 0;
+
+//! One bit per position in client_list, set if the CLIENT is queued
+static UInt8 update_queued[ON_CLIENT_BITMAP_SIZE];
+
+//! One bit per position in client_list, set if the CLIENT has an entry in
+//! update_queue, whether it is still queued or not
+static UInt8 update_listed[ON_CLIENT_BITMAP_SIZE];
+
+//! The earliest time an update may next be sent to each CLIENT
+static tick_t update_retry_time[ONE_NET_MASTER_MAX_CLIENTS];
+
+//! Number of times an update has been sent to each CLIENT without an answer
+static UInt8 update_retries[ONE_NET_MASTER_MAX_CLIENTS];
+
+//! Number of key fragment broadcasts left to send for this key change
+static UInt8 rekey_broadcasts_left = 0;
+
+//! The time the next key fragment broadcast is due
+static tick_t rekey_broadcast_time = 0;
+
+//! The time after which CLIENTs that have not confirmed the new key are sent
+//! it directly
+static tick_t rekey_activation_time = 0;
+
+//! Sending device information for messages sent to the broadcast DID
+static on_sending_device_t broadcast_device;
+
+//! The RAM-only information for each CLIENT, indexed like client_list
+static on_sending_device_ram_t client_ram[ONE_NET_MASTER_MAX_CLIENTS];
+
 
 
 //! @} ONE-NET_MASTER_pri_var
@@ -249,15 +345,31 @@ static on_message_status_t on_master_stream_txn_hdlr(
 
 static one_net_status_t init_internal(void);
 static one_net_status_t rm_client(const on_encoded_did_t * const CLIENT_DID);
-// TODO -- June 2, 2012 - sort_client_list_by_encoded_did appears to not be
-// used anywhere.  Commenting out for a clean compile
-#if 0
-static void sort_client_list_by_encoded_did(void);
-#endif
+static SInt16 client_did_slot(const on_encoded_did_t * const DID);
+static SInt16 raw_client_did_slot(const on_raw_did_t * const RAW_DID);
+static on_client_t* client_in_slot(SInt16 slot,
+  const on_encoded_did_t* CLIENT_DID);
+static void index_client(UInt16 list_index);
+static void unindex_client(UInt16 list_index);
+static void rebuild_client_index(void);
+static void set_client_bit(UInt8* bitmap, UInt16 index, BOOL used);
+static SInt16 lowest_clear_client_bit(const UInt8* bitmap);
+static void check_in_heap_swap(UInt16 i, UInt16 j);
+static void check_in_heap_sift(UInt16 i);
+static void check_in_heap_update(UInt16 list_index);
+static void check_in_heap_remove(UInt16 list_index);
+static BOOL client_update_pending(UInt16 list_index);
+static void queue_client_update(UInt16 list_index);
+static void queue_all_client_updates(void);
+static void dequeue_client_update(UInt16 list_index);
+static BOOL send_queued_updates(UInt8 admin_msg_id,
+  const UInt8* admin_payload, tick_t time_now);
 static UInt16 find_lowest_vacant_did(void);
 static SInt16 find_vacant_client_list_index(void);
 
 static on_sending_device_t * sender_info(const on_encoded_did_t * const DID);
+static on_sending_device_ram_t* sender_ram(
+  const on_sending_device_t* device);
 static void check_updates_in_progress(void);
 
 
@@ -265,9 +377,8 @@ static one_net_status_t send_admin_pkt(const UInt8 admin_msg_id,
   const on_encoded_did_t* const did, const UInt8* const pld,
   tick_t send_time_from_now);
 
-static on_message_status_t handle_admin_pkt(const on_encoded_did_t * const
-  SRC_DID, const UInt8 * const DATA, on_client_t ** client,
-  on_ack_nack_t* ack_nack);
+static on_message_status_t handle_admin_pkt(const on_pkt_t * const pkt,
+  const UInt8 * const DATA, on_client_t ** client, on_ack_nack_t* ack_nack);
 
 static BOOL is_invite_did(const on_encoded_did_t* const encoded_did);
 static on_client_t* get_invite_client(void);
@@ -275,6 +386,7 @@ static void on_master_adjust_recipient_list(const on_single_data_queue_t*
   const msg, on_recipient_list_t** recipient_send_list);
 
 static void check_clients_for_missed_check_ins(void);
+static UInt32 keep_alive_slot_delay(UInt16 list_index);
 
 
 
@@ -374,6 +486,9 @@ void one_net_master_condense_client_memory(void)
             // move everything up
             one_net_memmove(&client_list[i], &client_list[i+1],
               (ONE_NET_MASTER_MAX_CLIENTS - i - 1) * sizeof(on_client_t));
+            one_net_memmove(&client_ram[i], &client_ram[i+1],
+              (ONE_NET_MASTER_MAX_CLIENTS - i - 1) *
+              sizeof(on_sending_device_ram_t));
             i--;
         }
         else
@@ -387,6 +502,8 @@ void one_net_master_condense_client_memory(void)
         one_net_memmove(client_list[i].device.did, ON_ENCODED_BROADCAST_DID,
           ON_ENCODED_DID_LEN);
     }
+
+    rebuild_client_index();
 }
 
 
@@ -584,6 +701,10 @@ one_net_status_t one_net_master_init(const UInt8 * PARAM, UInt16 PARAM_LEN,
     } // loop to look for Multi-Hop and Multi-Hop repeaters //
     #endif
 
+    #ifdef PEER
+    one_net_sort_peers(NULL);
+    #endif
+
     on_state = ON_LISTEN_FOR_DATA;
     if((status = init_internal()) != ONS_SUCCESS)
     {
@@ -616,6 +737,14 @@ one_net_status_t one_net_master_change_key_fragment(
     {
         client_list[i].use_current_key = FALSE;
     }
+    queue_all_client_updates();
+
+    // broadcast the new fragment under the old key first.  Only the CLIENTs
+    // that have not confirmed it by the activation time are sent it directly.
+    rekey_broadcasts_left = ON_REKEY_BROADCASTS;
+    rekey_broadcast_time = get_tick_count();
+    rekey_activation_time = rekey_broadcast_time +
+      MS_TO_TICK(ON_REKEY_ACTIVATION_MS);
 
     #ifdef AUTO_SAVE
     save = TRUE;
@@ -760,6 +889,8 @@ one_net_status_t one_net_master_invite(const one_net_xtea_key_t * const KEY,
     client->keep_alive_interval = ONE_NET_MASTER_DEFAULT_KEEP_ALIVE;
     client->device.data_rate = ONE_NET_DATA_RATE_38_4;
     client->device.msg_id = data_pkt_ptrs.msg_id;
+    one_net_memset(&client_ram[client - client_list], 0,
+      sizeof(on_sending_device_ram_t));
     // 2-21-13 ////////////////////////////////////////////////
     one_net_uint16_to_byte_stream(master_param->next_client_did,
       raw_invite_did);
@@ -885,6 +1016,7 @@ one_net_status_t one_net_master_remove_device(
         // 2-21-13 //////////////////////////////////////
         client_list[i].send_remove_device_message = TRUE;
     }
+    queue_all_client_updates();
 
     #ifdef PEER
     // remove any peers of this device.
@@ -942,6 +1074,14 @@ one_net_xtea_key_t* master_get_encryption_key(
         return (one_net_xtea_key_t*)(on_base_param->current_key);
     }
 
+    if(is_broadcast_did(did))
+    {
+        // new key fragments are broadcast under the key the CLIENTs have.
+        return key_update_in_progress ?
+          (one_net_xtea_key_t*)(on_base_param->old_key) :
+          (one_net_xtea_key_t*)(on_base_param->current_key);
+    }
+
     client = client_info(did);
     if(client == NULL)
     {
@@ -1242,6 +1382,8 @@ one_net_status_t one_net_master_add_client(const on_features_t features,
     client->flags |= ON_JOINED;
     client->device.data_rate = ONE_NET_DATA_RATE_38_4;
     client->device.features = features;
+    one_net_memset(&client_ram[client - client_list], 0,
+      sizeof(on_sending_device_ram_t));
     client->send_remove_device_message = FALSE;
     client->use_current_key = TRUE;
     client->keep_alive_interval = ONE_NET_MASTER_DEFAULT_KEEP_ALIVE;
@@ -1255,6 +1397,7 @@ one_net_status_t one_net_master_add_client(const on_features_t features,
     #endif
     one_net_uint16_to_byte_stream(master_param->next_client_did, raw_did);
     on_encode(client->device.did, raw_did, ON_ENCODED_DID_LEN);
+    index_client(vacant_index);
 
 
     // if these are not NULL, the master is passing these parameters to the
@@ -1334,6 +1477,7 @@ one_net_status_t one_net_master_add_client(const on_features_t features,
                 client_list[i].send_add_device_message = FALSE;
             }
         }
+        queue_all_client_updates();
     }
 
     #ifdef AUTO_SAVE
@@ -1675,21 +1819,48 @@ int master_nv_crc(const UInt8* param, const UInt8* peer_param)
 */
 on_client_t* client_info(const on_encoded_did_t* CLIENT_DID)
 {
-    UInt16 i;
-
     if(!CLIENT_DID)
     {
         return 0;
     } // if the parameter is invalid //
 
-    for(i = 0; i < master_param->client_count; i++)
+    return client_in_slot(client_did_slot(CLIENT_DID), CLIENT_DID);
+} // client_info //
+
+
+/*!
+    \brief Returns the CLIENT information for a CLIENT whose slot is known.
+
+    \param[in] slot The CLIENT's slot in client_index, or -1 if it has none
+    \param[in] CLIENT_DID The encoded device id of the CLIENT.  Used if the
+      CLIENT is not in the index.
+
+    \return The CLIENT information if the information was found
+            0 If an error occured.
+*/
+static on_client_t* client_in_slot(SInt16 slot,
+  const on_encoded_did_t* CLIENT_DID)
+{
+    UInt16 i;
+
+    if(slot >= 0)
     {
-        if(on_encoded_did_equal(CLIENT_DID,
-          (const on_encoded_did_t * const)&client_list[i].device.did))
+        if((i = client_index[slot]) != ON_CLIENT_INDEX_NONE)
         {
             return &(client_list[i]);
         } // if the CLIENT was found //
-    } // loop to find the CLIENT //
+    } // if the DID has a slot in the index //
+    else if(unindexed_client_count)
+    {
+        for(i = 0; i < ONE_NET_MASTER_MAX_CLIENTS; i++)
+        {
+            if(on_encoded_did_equal(CLIENT_DID,
+              (const on_encoded_did_t * const)&client_list[i].device.did))
+            {
+                return &(client_list[i]);
+            } // if the CLIENT was found //
+        } // loop to find the CLIENT //
+    } // else if some CLIENTs are not in the index //
 
     // check to see if this is a device currently accepting an invite.
     // If it is, then assign it the next DID
@@ -1699,7 +1870,7 @@ on_client_t* client_info(const on_encoded_did_t* CLIENT_DID)
     }
 
     return 0;
-} // client_info //
+} // client_in_slot //
 
 
 #ifdef BLOCK_MESSAGES_ENABLED
@@ -1820,6 +1991,7 @@ on_nack_rsn_t on_master_initiate_block_msg(block_stream_msg_t* msg,
   on_ack_nack_t* ack_nack)
 {
     on_nack_rsn_t* nr = &ack_nack->nack_reason;
+    block_stream_msg_t* session;
     ack_nack->handle = ON_ACK;
     *nr = ON_NACK_RSN_NO_ERROR;
 
@@ -1829,7 +2001,7 @@ on_nack_rsn_t on_master_initiate_block_msg(block_stream_msg_t* msg,
         return *nr;
     }
 
-    if(bs_msg.transfer_in_progress)
+    if(!(session = bs_session_slot(msg)))
     {
         *nr = ON_NACK_RSN_BUSY;
     }
@@ -1841,7 +2013,8 @@ on_nack_rsn_t on_master_initiate_block_msg(block_stream_msg_t* msg,
         {
             *nr = ON_NACK_RSN_DEVICE_NOT_IN_NETWORK;
         }
-        one_net_memmove(&bs_msg, msg, sizeof(block_stream_msg_t));
+        one_net_memmove(session, msg, sizeof(block_stream_msg_t));
+        session->transfer_in_progress = FALSE; // until checked
 
         if(!features_block_capable(client->device.features))
         {
@@ -1849,22 +2022,21 @@ on_nack_rsn_t on_master_initiate_block_msg(block_stream_msg_t* msg,
         }
 
         if(!features_data_rate_capable(THIS_DEVICE_FEATURES,
-          bs_msg.data_rate) || !features_data_rate_capable(
-          client->device.features, bs_msg.data_rate))
+          session->data_rate) || !features_data_rate_capable(
+          client->device.features, session->data_rate))
         {
             *nr = ON_NACK_RSN_INVALID_DATA_RATE;
         }
 
-        set_bs_transfer_type(&bs_msg.flags, ON_BLK_TRANSFER);
-        bs_msg.src = NULL;
-        bs_msg.dst = &(client->device);
-        bs_msg.bs_on_state = ON_LISTEN_FOR_DATA;
-        ont_set_timer(ONT_BS_TIMER, 0);
+        set_bs_transfer_type(&session->flags, ON_BLK_TRANSFER);
+        session->src = NULL;
+        session->dst = &(client->device);
+        session->bs_on_state = ON_LISTEN_FOR_DATA;
     }
 
     if(*nr == ON_NACK_RSN_NO_ERROR)
     {
-        bs_msg.transfer_in_progress = TRUE;
+        session->transfer_in_progress = TRUE;
     }
     return *nr;
 }
@@ -1989,10 +2161,11 @@ on_nack_rsn_t on_master_initiate_stream_msg(block_stream_msg_t* msg,
   on_ack_nack_t* ack_nack)
 {
     on_nack_rsn_t* nr = &ack_nack->nack_reason;
+    block_stream_msg_t* session;
     ack_nack->handle = ON_ACK;
     *nr = ON_NACK_RSN_NO_ERROR;
 
-    if(bs_msg.transfer_in_progress)
+    if(!(session = bs_session_slot(msg)))
     {
         *nr = ON_NACK_RSN_BUSY;
     }
@@ -2000,7 +2173,8 @@ on_nack_rsn_t on_master_initiate_stream_msg(block_stream_msg_t* msg,
     {
         on_client_t* client = client_info(
           (const on_encoded_did_t* const) &(msg->dst->did));
-        one_net_memmove(&bs_msg, msg, sizeof(block_stream_msg_t));
+        one_net_memmove(session, msg, sizeof(block_stream_msg_t));
+        session->transfer_in_progress = FALSE; // until checked
         if(!client)
         {
             *nr = ON_NACK_RSN_DEVICE_NOT_IN_NETWORK;
@@ -2012,22 +2186,21 @@ on_nack_rsn_t on_master_initiate_stream_msg(block_stream_msg_t* msg,
         }
 
         if(!features_data_rate_capable(THIS_DEVICE_FEATURES,
-          bs_msg.data_rate) || !features_data_rate_capable(
-          client->device.features, bs_msg.data_rate))
+          session->data_rate) || !features_data_rate_capable(
+          client->device.features, session->data_rate))
         {
             *nr = ON_NACK_RSN_INVALID_DATA_RATE;
         }
 
-        set_bs_transfer_type(&bs_msg.flags, ON_STREAM_TRANSFER);
-        bs_msg.src = NULL;
-        bs_msg.dst = &(client->device);
-        bs_msg.bs_on_state = ON_LISTEN_FOR_DATA;
-        ont_set_timer(ONT_BS_TIMER, 0);
+        set_bs_transfer_type(&session->flags, ON_STREAM_TRANSFER);
+        session->src = NULL;
+        session->dst = &(client->device);
+        session->bs_on_state = ON_LISTEN_FOR_DATA;
     }
 
     if(*nr == ON_NACK_RSN_NO_ERROR)
     {
-        bs_msg.transfer_in_progress = TRUE;
+        session->transfer_in_progress = TRUE;
     }
     return *nr;
 }
@@ -2070,25 +2243,26 @@ static on_message_status_t on_master_single_data_hdlr(
     BOOL stay_awake;
     on_message_status_t msg_status;
     on_msg_hdr_t msg_hdr;
-    on_raw_did_t raw_src_did, raw_repeater_did;
+    const on_raw_did_t* const raw_src_did =
+      (const on_raw_did_t*) &(pkt->raw_src_did);
+    const on_raw_did_t* const raw_repeater_did =
+      (const on_raw_did_t*) &(pkt->raw_rptr_did);
     UInt8 response_pid;
     on_sending_device_t* device;
     on_client_t* client;
-    client = client_info((const on_encoded_did_t* const)
+    client = client_in_slot(raw_client_did_slot(raw_src_did),
+      (const on_encoded_did_t* const)
       &(pkt->packet_bytes[ON_ENCODED_SRC_DID_IDX]));
 
-    on_decode(raw_src_did, &(pkt->packet_bytes[ON_ENCODED_SRC_DID_IDX]),
-      ON_ENCODED_DID_LEN);
-    on_decode(raw_repeater_did, &(pkt->packet_bytes[ON_ENCODED_RPTR_DID_IDX]),
-      ON_ENCODED_DID_LEN);
-
     msg_hdr.msg_type = *msg_type;
     msg_hdr.raw_pid = pkt->raw_pid;
     msg_hdr.msg_id = pkt->msg_id;
 
     // we'll be sending it back to the source
-    if(!(device = sender_info((const on_encoded_did_t* const)
-      &(pkt->packet_bytes[ON_ENCODED_SRC_DID_IDX]))))
+    device = client ? &(client->device) : sender_info(
+      (const on_encoded_did_t* const)
+      &(pkt->packet_bytes[ON_ENCODED_SRC_DID_IDX]));
+    if(!device)
     {
         // I think we should have solved this problem before now, but abort if
         // we have not.
@@ -2105,12 +2279,24 @@ static on_message_status_t on_master_single_data_hdlr(
         goto omsdh_build_resp;
     }
 
+    // A CLIENT whose message decrypted with the current key has confirmed
+    // the key change, whether it got the new key from a broadcast or not.
+    if(client && !client->use_current_key && (*txn)->key ==
+      (one_net_xtea_key_t*) on_base_param->current_key)
+    {
+        client->use_current_key = TRUE;
+        one_net_master_update_result(ONE_NET_UPDATE_NETWORK_KEY,
+          raw_src_did, ack_nack);
+        #ifdef AUTO_SAVE
+        save = TRUE;
+        #endif
+    }
+
     switch(*msg_type)
     {
         case ON_ADMIN_MSG:
-            msg_status = handle_admin_pkt((const on_encoded_did_t* const)
-              &(pkt->packet_bytes[ON_ENCODED_SRC_DID_IDX]),
-              &raw_pld[ON_PLD_DATA_IDX], &client, ack_nack);
+            msg_status = handle_admin_pkt(pkt, &raw_pld[ON_PLD_DATA_IDX],
+              &client, ack_nack);
             break;
         #ifdef ROUTE
         case ON_ROUTE_MSG:
@@ -2137,18 +2323,67 @@ static on_message_status_t on_master_single_data_hdlr(
         }
         #endif
         default:
-            #ifndef ONE_NET_MULTI_HOP
-            msg_status = one_net_master_handle_single_pkt(
-              &raw_pld[ON_PLD_DATA_IDX], &msg_hdr, (const on_raw_did_t* const)
-              &raw_src_did, (const on_raw_did_t* const) &raw_repeater_did,
-              ack_nack);
-            #else
-            msg_status = one_net_master_handle_single_pkt(
-              &raw_pld[ON_PLD_DATA_IDX], &msg_hdr, (const on_raw_did_t* const)
-              &raw_src_did, (const on_raw_did_t* const) &raw_repeater_did,
-              ack_nack, (*txn)->hops, &((*txn)->max_hops));
+        {
+            UInt8* app_pld = &raw_pld[ON_PLD_DATA_IDX];
+            UInt8 num_msgs = 1;
+            UInt8 num_handled = 0;
+            
+            #ifdef EXTENDED_SINGLE
+            // several application messages sent together.  Give them to the
+            // application one at a time as if each came in by itself.
+            if(*msg_type == ON_COALESCED_APP_MSG)
+            {
+                num_msgs = app_pld[ON_COALESCED_COUNT_IDX];
+                // the messages must all fit in the data the pid says came
+                // in, not just in the largest single packet.
+                if(num_msgs == 0 || num_msgs > ON_MAX_COALESCED_MSGS ||
+                  ON_COALESCED_MSG_IDX + num_msgs *
+                  ONA_SINGLE_PACKET_PAYLOAD_LEN > get_num_payload_blocks(
+                  pkt->raw_pid) * ONE_NET_XTEA_BLOCK_SIZE - ON_PLD_DATA_IDX)
+                {
+                    ack_nack->nack_reason = ON_NACK_RSN_BAD_SIZE_ERROR;
+                    msg_status = ON_MSG_CONTINUE;
+                    break;
+                }
+                app_pld = &app_pld[ON_COALESCED_MSG_IDX];
+                msg_hdr.msg_type = ON_APP_MSG;
+            }
+            #endif
+            
+            do
+            {
+                #ifndef ONE_NET_MULTI_HOP
+                msg_status = one_net_master_handle_single_pkt(app_pld,
+                  &msg_hdr, raw_src_did, raw_repeater_did, ack_nack);
+                #else
+                msg_status = one_net_master_handle_single_pkt(app_pld,
+                  &msg_hdr, raw_src_did, raw_repeater_did, ack_nack,
+                  (*txn)->hops, &((*txn)->max_hops));
+                #endif
+                if(msg_status == ON_MSG_CONTINUE && !ack_nack->nack_reason)
+                {
+                    num_handled++;
+                }
+                app_pld += ONA_SINGLE_PACKET_PAYLOAD_LEN;
+            } while(--num_msgs && msg_status == ON_MSG_CONTINUE &&
+              !ack_nack->nack_reason);
+            
+            #ifdef EXTENDED_SINGLE
+            if(*msg_type == ON_COALESCED_APP_MSG && num_handled &&
+              msg_status == ON_MSG_CONTINUE)
+            {
+                // ACK the messages that were handled by count, with the
+                // reason the next one failed, if one did, above that.  A
+                // NACK would have the sender try again, and the ones that
+                // were handled would be handled twice.
+                ack_nack->payload->ack_value = (((UInt32)
+                  ack_nack->nack_reason) << 8) | num_handled;
+                ack_nack->handle = ON_ACK_VALUE;
+                ack_nack->nack_reason = ON_NACK_RSN_NO_ERROR;
+            }
             #endif
             break;
+        }
     }
 
 
@@ -2191,11 +2426,14 @@ omsdh_build_resp:
     if(ack_nack->nack_reason == ON_NACK_RSN_NO_ERROR)
     {
         // device has checked in, so reset the next check-in time
-        // give it 5 extra seconds.
+        // give it 5 extra seconds, plus the half interval it may have been
+        // told to wait to get to its keep-alive slot.
         client->next_check_in_time = get_tick_count() +
-          MS_TO_TICK(5000 + client->keep_alive_interval);
+          MS_TO_TICK(5000 + client->keep_alive_interval +
+          client->keep_alive_interval / 2);
+        check_in_heap_update(client - client_list);
         stay_awake = one_net_master_device_is_awake(FALSE,
-          (const on_raw_did_t * const)&raw_src_did);
+          raw_src_did);
     }
 
     stay_awake = stay_awake || device_should_stay_awake(
@@ -2424,6 +2662,7 @@ static void admin_txn_hdlr(const UInt8* const raw_pld,
             if(ack_nack->nack_reason == ON_NACK_RSN_NO_ERROR)
             {
                 client->keep_alive_interval = ack_nack->payload->ack_time_ms;
+                check_in_heap_update(client - client_list);
             }
             update = ONE_NET_UPDATE_KEEP_ALIVE;
             break;
@@ -2513,9 +2752,23 @@ static on_message_status_t on_master_single_txn_hdlr(on_txn_t ** txn,
 {
     on_msg_hdr_t msg_hdr;
     on_raw_did_t dst;
-    on_client_t* client = client_info((const on_encoded_did_t* const)
-      &(pkt->packet_bytes[ON_ENCODED_DST_DID_IDX]));
+    UInt8* app_pld = raw_pld;
+    UInt8 num_msgs = 1;
+    UInt8 num_acked, i;
+    on_message_status_t msg_status = status;
+    on_client_t* client;
+
+    if(is_broadcast_did((const on_encoded_did_t*)
+      &(pkt->packet_bytes[ON_ENCODED_DST_DID_IDX])))
+    {
+        // nobody answers a broadcast and there is no CLIENT to update.  A
+        // new key fragment broadcast is confirmed by each CLIENT's later
+        // messages, or through the update sent to each CLIENT that has not.
+        return ON_MSG_SUCCESS;
+    }
 
+    client = client_info((const on_encoded_did_t* const)
+      &(pkt->packet_bytes[ON_ENCODED_DST_DID_IDX]));
     if(!client)
     {
         return ON_MSG_INTERNAL_ERR;
@@ -2535,14 +2788,52 @@ static on_message_status_t on_master_single_txn_hdlr(on_txn_t ** txn,
           ack_nack, client);
     }
 
-    #ifndef ONE_NET_MULTI_HOP
-    one_net_master_single_txn_status(status, (*txn)->retry, msg_hdr,
-      raw_pld, (const on_raw_did_t*) &dst, ack_nack);
-    #else
-    one_net_master_single_txn_status(status, (*txn)->retry, msg_hdr,
-      raw_pld, (const on_raw_did_t*) &dst, ack_nack, pkt->hops);
+    num_acked = num_msgs;
+    #ifdef EXTENDED_SINGLE
+    // a coalesced message carried several ON_APP_MSGs.  Report on each one
+    // to the application as if it had been sent by itself.
+    if(*msg_type == ON_COALESCED_APP_MSG)
+    {
+        num_msgs = raw_pld[ON_COALESCED_COUNT_IDX];
+        num_acked = num_msgs;
+        app_pld = &raw_pld[ON_COALESCED_MSG_IDX];
+        msg_hdr.msg_type = ON_APP_MSG;
+        
+        // The ACK holds how many of the messages were handled.  The rest
+        // were not.
+        if(!ack_nack->nack_reason && ack_nack->handle == ON_ACK_VALUE &&
+          (UInt8) ack_nack->payload->ack_value < num_msgs)
+        {
+            num_acked = (UInt8) ack_nack->payload->ack_value;
+        }
+    }
     #endif
 
+    for(i = 0; i < num_msgs; i++)
+    {
+        if(i == num_acked)
+        {
+            // the reason this one failed is above the count.
+            msg_status = ON_MSG_FAIL;
+            ack_nack->nack_reason = (on_nack_rsn_t)
+              (ack_nack->payload->ack_value >> 8);
+            ack_nack->handle = ON_NACK;
+            if(!ack_nack->nack_reason)
+            {
+                ack_nack->nack_reason = ON_NACK_RSN_GENERAL_ERR;
+            }
+        }
+        
+        #ifndef ONE_NET_MULTI_HOP
+        one_net_master_single_txn_status(msg_status, (*txn)->retry, msg_hdr,
+          app_pld, (const on_raw_did_t*) &dst, ack_nack);
+        #else
+        one_net_master_single_txn_status(msg_status, (*txn)->retry, msg_hdr,
+          app_pld, (const on_raw_did_t*) &dst, ack_nack, pkt->hops);
+        #endif
+        app_pld += ONA_SINGLE_PACKET_PAYLOAD_LEN;
+    }
+
     #if defined(BLOCK_MESSAGES_ENABLED) && defined(ONE_NET_MULTI_HOP)
     if(bs_msg.transfer_in_progress)
     {
@@ -2587,9 +2878,12 @@ static on_message_status_t on_master_single_txn_hdlr(on_txn_t ** txn,
     if(ack_nack->nack_reason == ON_NACK_RSN_NO_ERROR)
     {
         // device has checked in, so reset the next check-in time
-        // give it 5 extra seconds.
+        // give it 5 extra seconds, plus the half interval it may have been
+        // told to wait to get to its keep-alive slot.
         client->next_check_in_time = get_tick_count() +
-          MS_TO_TICK(5000 + client->keep_alive_interval);
+          MS_TO_TICK(5000 + client->keep_alive_interval +
+          client->keep_alive_interval / 2);
+        check_in_heap_update(client - client_list);
         one_net_master_device_is_awake(TRUE,
           (const on_raw_did_t * const)&dst);
     }
@@ -2768,7 +3062,16 @@ static one_net_status_t init_internal(void)
     #endif
 
     get_sender_info = &sender_info;
+    get_sender_ram = &sender_ram;
     device_is_master = TRUE;
+    rebuild_client_index();
+
+    one_net_memset(&broadcast_device, 0, sizeof(broadcast_device));
+    one_net_memmove(broadcast_device.did, ON_ENCODED_BROADCAST_DID,
+      ON_ENCODED_DID_LEN);
+    broadcast_device.data_rate = ONE_NET_DATA_RATE_38_4;
+    broadcast_device.features = FEATURES_UNKNOWN;
+    rekey_broadcasts_left = 0;
     one_net_init();
 
     #ifdef BLOCK_MESSAGES_ENABLED
@@ -2817,6 +3120,7 @@ static one_net_status_t rm_client(const on_encoded_did_t * const DID)
 
 
     // make this slot vacant
+    unindex_client(client - client_list);
     one_net_memmove(client->device.did, ON_ENCODED_BROADCAST_DID,
       ON_ENCODED_DID_LEN);
 
@@ -2832,43 +3136,530 @@ static one_net_status_t rm_client(const on_encoded_did_t * const DID)
 } // rm_client //
 
 
-// TODO -- June 2, 2012 - sort_client_list_by_encoded_did appears to not be
-// used anywhere.  Commenting out for a clean compile
-#if 0
 /*!
-    \brief Sorts the client list by did for a cleaner printout.
+    \brief Finds the slot in client_index for a CLIENT DID.
+
+    \param[in] DID The encoded DID to look up.
+
+    \return The slot in client_index for DID.
+            -1 if DID is not a CLIENT DID that fits in the index.
 */
-static void sort_client_list_by_encoded_did(void)
+static SInt16 client_did_slot(const on_encoded_did_t * const DID)
 {
-    UInt16 i;
-    on_raw_did_t raw_did1;
-    on_raw_did_t raw_did2;
+    on_raw_did_t raw_did;
 
-    // the client list will almost always be in order already.  When it's not,
-    // generally only one element will be out of order, so instead of having a
-    // nested loop, if we ever find an element out of order, we'll just iterate
-    // through the whole list again.
-    for(i = 1; i < master_param->client_count; i++)
+    if(on_decode(raw_did, *DID, ON_ENCODED_DID_LEN) != ONS_SUCCESS)
     {
-        on_decode(raw_did1, client_list[i-1].device.did,
-          ON_ENCODED_DID_LEN);
-        on_decode(raw_did2, client_list[i].device.did,
-          ON_ENCODED_DID_LEN);
+        return -1;
+    } // if the DID is not valid //
+
+    return raw_client_did_slot((const on_raw_did_t*) &raw_did);
+} // client_did_slot //
+
+
+/*!
+    \brief Finds the slot in client_index a raw DID maps to.
+
+    \param[in] RAW_DID The raw DID.
+
+    \return The slot, or -1 if the DID cannot be a CLIENT's.
+*/
+static SInt16 raw_client_did_slot(const on_raw_did_t * const RAW_DID)
+{
+    UInt16 did = one_net_byte_stream_to_uint16(*RAW_DID);
+
+    if(did < ONE_NET_INITIAL_CLIENT_DID)
+    {
+        return -1; // broadcast or MASTER DID
+    }
+
+    did -= ONE_NET_INITIAL_CLIENT_DID;
+    if(did % ON_CLIENT_DID_INCREMENT)
+    {
+        return -1;
+    }
+
+    did /= ON_CLIENT_DID_INCREMENT;
+    return (did < ONE_NET_MASTER_MAX_CLIENTS) ? (SInt16) did : -1;
+} // raw_client_did_slot //
+
+
+/*!
+    \brief Adds a CLIENT in client_list to client_index.
+
+    \param[in] list_index The position of the CLIENT in client_list.
+
+    \return void
+*/
+static void index_client(UInt16 list_index)
+{
+    SInt16 slot = client_did_slot((const on_encoded_did_t*)
+      client_list[list_index].device.did);
+
+    set_client_bit(list_slot_used, list_index, TRUE);
+    check_in_heap_update(list_index);
+    if(slot < 0)
+    {
+        unindexed_client_count++;
+        return;
+    } // if the DID does not fit in the index //
+
+    client_index[slot] = list_index;
+    set_client_bit(did_slot_used, slot, TRUE);
+} // index_client //
+
+
+/*!
+    \brief Removes a CLIENT in client_list from client_index.
+
+    \param[in] list_index The position of the CLIENT in client_list.
+
+    \return void
+*/
+static void unindex_client(UInt16 list_index)
+{
+    SInt16 slot = client_did_slot((const on_encoded_did_t*)
+      client_list[list_index].device.did);
+
+    set_client_bit(list_slot_used, list_index, FALSE);
+    check_in_heap_remove(list_index);
+    dequeue_client_update(list_index);
+    if(slot >= 0)
+    {
+        client_index[slot] = ON_CLIENT_INDEX_NONE;
+        set_client_bit(did_slot_used, slot, FALSE);
+    } // if the DID is in the index //
+    else if(unindexed_client_count)
+    {
+        unindexed_client_count--;
+    } // else if the DID was counted as unindexed //
+} // unindex_client //
+
 
-        if(one_net_byte_stream_to_uint16(raw_did1) >
-          one_net_byte_stream_to_uint16(raw_did2))
+/*!
+    \brief Rebuilds client_index, check_in_heap and update_queue from
+      client_list.
+
+    Needed whenever client_list is filled in or moved around as a whole, for
+    example when the parameters are loaded or the list is condensed.
+
+    \return void
+*/
+static void rebuild_client_index(void)
+{
+    UInt16 i;
+    UInt16 num_clients_encountered = 0;
+
+    for(i = 0; i < ONE_NET_MASTER_MAX_CLIENTS; i++)
+    {
+        client_index[i] = ON_CLIENT_INDEX_NONE;
+        check_in_heap_pos[i] = ON_CLIENT_INDEX_NONE;
+    }
+    check_in_heap_size = 0;
+    update_queue_len = 0;
+    one_net_memset(update_queued, 0, sizeof(update_queued));
+    one_net_memset(update_listed, 0, sizeof(update_listed));
+    one_net_memset(did_slot_used, 0, sizeof(did_slot_used));
+    one_net_memset(list_slot_used, 0, sizeof(list_slot_used));
+    unindexed_client_count = 0;
+
+    for(i = 0; i < ONE_NET_MASTER_MAX_CLIENTS &&
+      num_clients_encountered < master_param->client_count; i++)
+    {
+        if(!is_broadcast_did((const on_encoded_did_t*)
+          client_list[i].device.did))
         {
-            // swap.
-            on_client_t temp = client_list[i-1];
-            client_list[i-1] = client_list[i];
-            client_list[i] = temp;
-            i = 0; // make it 0, not 1 because the loop increments i.
+            index_client(i);
+            num_clients_encountered++;
         }
     }
-}
-#endif
+
+    queue_all_client_updates();
+} // rebuild_client_index //
 
 
+/*!
+    \brief Sets or clears a bit in one of the CLIENT bitmaps.
+
+    \param[out] bitmap did_slot_used or list_slot_used.
+    \param[in] index The DID slot or client_list position.
+    \param[in] used TRUE to set the bit, FALSE to clear it.
+
+    \return void
+*/
+static void set_client_bit(UInt8* bitmap, UInt16 index, BOOL used)
+{
+    UInt8 mask = (0x80 >> (index % 8));
+
+    if(used)
+    {
+        bitmap[index / 8] |= mask;
+    }
+    else
+    {
+        bitmap[index / 8] &= ~mask;
+    }
+} // set_client_bit //
+
+
+/*!
+    \brief Finds the lowest clear bit in one of the CLIENT bitmaps.
+
+    Full bytes are skipped without looking at their bits.
+
+    \param[in] bitmap did_slot_used or list_slot_used.
+
+    \return The index of the lowest clear bit.
+            -1 if every bit is set.
+*/
+static SInt16 lowest_clear_client_bit(const UInt8* bitmap)
+{
+    UInt16 i;
+    UInt8 bit;
+
+    for(i = 0; i < ON_CLIENT_BITMAP_SIZE; i++)
+    {
+        if(bitmap[i] == 0xFF)
+        {
+            continue;
+        }
+
+        bit = 0;
+        while((bitmap[i] << bit) & 0x80)
+        {
+            bit++;
+        }
+
+        return (i * 8 + bit < ONE_NET_MASTER_MAX_CLIENTS) ?
+          (SInt16)(i * 8 + bit) : -1;
+    }
+
+    return -1;
+} // lowest_clear_client_bit //
+
+
+/*!
+    \brief Swaps two entries in check_in_heap.
+
+    \param[in] i The position of the first entry.
+    \param[in] j The position of the second entry.
+
+    \return void
+*/
+static void check_in_heap_swap(UInt16 i, UInt16 j)
+{
+    UInt16 temp = check_in_heap[i];
+
+    check_in_heap[i] = check_in_heap[j];
+    check_in_heap[j] = temp;
+    check_in_heap_pos[check_in_heap[i]] = i;
+    check_in_heap_pos[check_in_heap[j]] = j;
+} // check_in_heap_swap //
+
+
+/*!
+    \brief Moves an entry in check_in_heap up or down to where its check-in
+      time belongs.
+
+    \param[in] i The position of the entry.
+
+    \return void
+*/
+static void check_in_heap_sift(UInt16 i)
+{
+    UInt16 parent, child;
+
+    while(i > 0)
+    {
+        parent = (i - 1) / 2;
+        if(client_list[check_in_heap[parent]].next_check_in_time <=
+          client_list[check_in_heap[i]].next_check_in_time)
+        {
+            break;
+        }
+
+        check_in_heap_swap(i, parent);
+        i = parent;
+    }
+
+    while((child = 2 * i + 1) < check_in_heap_size)
+    {
+        if(child + 1 < check_in_heap_size &&
+          client_list[check_in_heap[child + 1]].next_check_in_time <
+          client_list[check_in_heap[child]].next_check_in_time)
+        {
+            child++;
+        }
+
+        if(client_list[check_in_heap[i]].next_check_in_time <=
+          client_list[check_in_heap[child]].next_check_in_time)
+        {
+            break;
+        }
+
+        check_in_heap_swap(i, child);
+        i = child;
+    }
+} // check_in_heap_sift //
+
+
+/*!
+    \brief Puts a CLIENT in check_in_heap, or moves it if it is already
+      there, after its check-in time or keep-alive interval changed.
+
+    CLIENTs with a keep-alive interval of 0 are not expected to check in and
+    are taken out of the heap.  A device that is still being invited is not
+    in list_slot_used yet and is left out.
+
+    \param[in] list_index The position of the CLIENT in client_list.
+
+    \return void
+*/
+static void check_in_heap_update(UInt16 list_index)
+{
+    UInt16 i = check_in_heap_pos[list_index];
+
+    if(!(list_slot_used[list_index / 8] & (0x80 >> (list_index % 8))))
+    {
+        return; // not a CLIENT yet.
+    }
+
+    if(client_list[list_index].keep_alive_interval == 0)
+    {
+        check_in_heap_remove(list_index);
+        return;
+    }
+
+    if(i == ON_CLIENT_INDEX_NONE)
+    {
+        i = check_in_heap_size++;
+        check_in_heap[i] = list_index;
+        check_in_heap_pos[list_index] = i;
+    }
+
+    check_in_heap_sift(i);
+} // check_in_heap_update //
+
+
+/*!
+    \brief Takes a CLIENT out of check_in_heap.
+
+    \param[in] list_index The position of the CLIENT in client_list.
+
+    \return void
+*/
+static void check_in_heap_remove(UInt16 list_index)
+{
+    UInt16 i = check_in_heap_pos[list_index];
+
+    if(i == ON_CLIENT_INDEX_NONE)
+    {
+        return;
+    }
+
+    check_in_heap_size--;
+    if(i != check_in_heap_size)
+    {
+        check_in_heap_swap(i, check_in_heap_size);
+        check_in_heap_pos[list_index] = ON_CLIENT_INDEX_NONE;
+        check_in_heap_sift(i);
+        return;
+    }
+
+    check_in_heap_pos[list_index] = ON_CLIENT_INDEX_NONE;
+} // check_in_heap_remove //
+
+
+/*!
+    \brief Checks whether a CLIENT still has an update to be sent.
+
+    \param[in] list_index The position of the CLIENT in client_list.
+
+    \return TRUE if the CLIENT has not been sent an add device, remove device,
+      or key change that is in progress.
+            FALSE otherwise.
+*/
+static BOOL client_update_pending(UInt16 list_index)
+{
+    const on_client_t* CLIENT = &client_list[list_index];
+
+    return CLIENT->send_add_device_message ||
+      CLIENT->send_remove_device_message || !CLIENT->use_current_key;
+} // client_update_pending //
+
+
+/*!
+    \brief Adds a CLIENT to update_queue if it is not already there.
+
+    The first update to a newly queued CLIENT may be sent right away.
+
+    \param[in] list_index The position of the CLIENT in client_list.
+
+    \return void
+*/
+static void queue_client_update(UInt16 list_index)
+{
+    if(update_queued[list_index / 8] & (0x80 >> (list_index % 8)))
+    {
+        return; // already queued.  Keep its retry time.
+    }
+
+    set_client_bit(update_queued, list_index, TRUE);
+    if(!(update_listed[list_index / 8] & (0x80 >> (list_index % 8))))
+    {
+        set_client_bit(update_listed, list_index, TRUE);
+        update_queue[update_queue_len++] = list_index;
+    }
+    update_retry_time[list_index] = 0;
+    update_retries[list_index] = 0;
+} // queue_client_update //
+
+
+/*!
+    \brief Queues every CLIENT that has an update to be sent.
+
+    Called when an update starts, since that sets the flags of most of the
+    CLIENTs at once.
+
+    \return void
+*/
+static void queue_all_client_updates(void)
+{
+    UInt16 i;
+
+    for(i = 0; i < ONE_NET_MASTER_MAX_CLIENTS; i++)
+    {
+        if((list_slot_used[i / 8] & (0x80 >> (i % 8))) &&
+          client_update_pending(i))
+        {
+            queue_client_update(i);
+        }
+    }
+} // queue_all_client_updates //
+
+
+/*!
+    \brief Takes a CLIENT out of update_queue.
+
+    Only the CLIENT's bit is cleared.  Its entry is dropped the next time
+    send_queued_updates goes through the queue.
+
+    \param[in] list_index The position of the CLIENT in client_list.
+
+    \return void
+*/
+static void dequeue_client_update(UInt16 list_index)
+{
+    set_client_bit(update_queued, list_index, FALSE);
+} // dequeue_client_update //
+
+
+/*!
+    \brief Sends an update to the queued CLIENTs that still need it.
+
+    Only the CLIENTs in update_queue are looked at.  CLIENTs that no longer
+    need any update, or were taken out of the queue, are dropped from it.  Up to ON_UPDATE_PIPELINE
+    CLIENTs whose retry time has passed are sent the update, each addressed
+    directly, and their next retry time is pushed back.
+
+    \param[in] admin_msg_id ON_RM_DEV, ON_ADD_DEV, or ON_NEW_KEY_FRAGMENT.
+    \param[in] admin_payload The payload of the admin message.
+    \param[in] time_now The current time.
+
+    \return TRUE if any CLIENT still needs this update, including sleeping
+      CLIENTs that will get it when they check in.
+            FALSE if the update is done.
+*/
+static BOOL send_queued_updates(UInt8 admin_msg_id,
+  const UInt8* admin_payload, tick_t time_now)
+{
+    UInt16 i, q;
+    UInt16 kept = 0;
+    UInt8 shift;
+    UInt8 num_sent = 0;
+    BOOL pending = FALSE;
+    BOOL queue_full = FALSE;
+    on_client_t* client;
+
+    for(q = 0; q < update_queue_len; q++)
+    {
+        i = update_queue[q];
+        client = &client_list[i];
+
+        if(!(update_queued[i / 8] & (0x80 >> (i % 8))) ||
+          !client_update_pending(i))
+        {
+            set_client_bit(update_queued, i, FALSE);
+            set_client_bit(update_listed, i, FALSE);
+            continue;
+        }
+
+        // the CLIENTs that stay keep their order.
+        update_queue[kept++] = i;
+        if(queue_full)
+        {
+            continue;
+        }
+
+        switch(admin_msg_id)
+        {
+            case ON_RM_DEV:
+                if(!client->send_remove_device_message)
+                {
+                    continue;
+                }
+                break;
+            case ON_ADD_DEV:
+                if(!client->send_add_device_message)
+                {
+                    continue;
+                }
+                break;
+            default:
+                if(client->use_current_key)
+                {
+                    continue;
+                }
+
+                // if it sleeps, we'll have to wait till it checks in.
+                if(features_device_sleeps(client->device.features))
+                {
+                    pending = TRUE;
+                    continue;
+                }
+        }
+
+        pending = TRUE;
+        if(num_sent >= ON_UPDATE_PIPELINE ||
+          time_now < update_retry_time[i])
+        {
+            continue;
+        }
+
+        if(send_admin_pkt(admin_msg_id,
+          (const on_encoded_did_t* const) &(client->device.did),
+          admin_payload, 0) != ONS_SUCCESS)
+        {
+            queue_full = TRUE; // try again next time.
+            continue;
+        }
+
+        num_sent++;
+        shift = update_retries[i] < ON_UPDATE_MAX_BACKOFF_SHIFT ?
+          update_retries[i] : ON_UPDATE_MAX_BACKOFF_SHIFT;
+        update_retry_time[i] = time_now +
+          (MS_TO_TICK(ON_UPDATE_RETRY_MS) << shift);
+        if(update_retries[i] < 0xFF)
+        {
+            update_retries[i]++;
+        }
+    }
+
+    update_queue_len = kept;
+    return pending;
+} // send_queued_updates //
+
+
 /*!
     \brief Find the lowest vacant did that can be assigned to the next client.
 
@@ -2878,32 +3669,19 @@ static void sort_client_list_by_encoded_did(void)
 */
 static UInt16 find_lowest_vacant_did(void)
 {
-    UInt16 i;
-    BOOL found;
-    on_raw_did_t raw_did;
-    UInt16 vacant_did = ONE_NET_INITIAL_CLIENT_DID;
+    SInt16 slot;
 
     if(master_param->client_count >= ONE_NET_MASTER_MAX_CLIENTS)
     {
         return 0; // list is full.
     }
 
-    do
+    if((slot = lowest_clear_client_bit(did_slot_used)) < 0)
     {
-        found = FALSE;
-        for(i = 0; i < ONE_NET_MASTER_MAX_CLIENTS; i++)
-        {
-            on_decode(raw_did, client_list[i].device.did, ON_ENCODED_DID_LEN);
-            if(one_net_byte_stream_to_uint16(raw_did) == vacant_did)
-            {
-                // this did is already taken, so increment
-                vacant_did += ON_CLIENT_DID_INCREMENT;
-                found = TRUE;
-            }
-        }
-    } while(found);
+        return 0;
+    }
 
-    return vacant_did;
+    return ONE_NET_INITIAL_CLIENT_DID + slot * ON_CLIENT_DID_INCREMENT;
 }
 
 
@@ -2915,17 +3693,7 @@ static UInt16 find_lowest_vacant_did(void)
 */
 static SInt16 find_vacant_client_list_index(void)
 {
-    UInt16 i;
-    for(i = 0; i < ONE_NET_MASTER_MAX_CLIENTS; i++)
-    {
-        if(is_broadcast_did((const on_encoded_did_t*)
-          client_list[i].device.did))
-        {
-            return i;
-        }
-    }
-
-    return -1;
+    return lowest_clear_client_bit(list_slot_used);
 }
 
 
@@ -2937,11 +3705,19 @@ static SInt16 find_vacant_client_list_index(void)
     \param[in] DID The device id of the device.
 
     \return Pointer to location that holds the sender information (should be
-      checked for 0, and should be checked if a new location).
+      checked for 0, and should be checked if a new location).  The broadcast
+      DID has its own sender information, used for key fragment broadcasts.
 */
 static on_sending_device_t * sender_info(const on_encoded_did_t * const DID)
 {
-    on_client_t* client = client_info(DID);
+    on_client_t* client;
+
+    if(DID && is_broadcast_did(DID))
+    {
+        return &broadcast_device;
+    }
+
+    client = client_info(DID);
     if(client == NULL)
     {
         return NULL;
@@ -2949,13 +3725,41 @@ static on_sending_device_t * sender_info(const on_encoded_did_t * const DID)
 
     return &(client->device);
 }
+
+
+/*!
+    \brief Finds the RAM-only information for a sending device.
+
+    \param[in] device The device's entry in client_list.
+
+    \return The device's element of client_ram.
+            NULL if device is not in client_list.
+*/
+static on_sending_device_ram_t* sender_ram(
+  const on_sending_device_t* device)
+{
+    const UInt8* first = (const UInt8*) &(client_list[0].device);
+    UInt16 offset;
+
+    if((const UInt8*) device < first || device >
+      &(client_list[ONE_NET_MASTER_MAX_CLIENTS - 1].device))
+    {
+        return NULL;
+    }
+
+    offset = (UInt16) ((const UInt8*) device - first);
+    if(offset % sizeof(on_client_t))
+    {
+        return NULL;
+    }
+
+    return &client_ram[offset / sizeof(on_client_t)];
+}
 
 
 static void check_updates_in_progress(void)
 {
-    static tick_t last_send_time = 0;
     tick_t time_now = get_tick_count();
-    const tick_t SEND_INTERVAL = MS_TO_TICK(5000);
 
     // The time to stop trying to update any devices which have not been updated
     // TODO -- should this be a port constant?  Should it exist at all?
@@ -2967,8 +3771,6 @@ static void check_updates_in_progress(void)
     UInt16 i;
     UInt8 admin_payload[4];
     on_ack_nack_t ack;
-    UInt8 admin_msg_id = 0xFF; // garbage argument.  Will be written over if
-                               // any real message is to be sent.
 
     ack.nack_reason = ON_NACK_RSN_NO_ERROR;
 
@@ -2985,29 +3787,21 @@ static void check_updates_in_progress(void)
             }
         }
 
-        remove_device_update_in_progress = FALSE;
+        admin_payload[0] = remove_device_did[0];
+        admin_payload[1] = remove_device_did[1];
+        #ifdef ONE_NET_MULTI_HOP
+        admin_payload[2] = on_base_param->num_mh_devices;
+        admin_payload[3] = on_base_param->num_mh_repeaters;
+        #else
+        // TODO -- should we ban multi-hop just because the master
+        // isn't capable.
+        admin_payload[2] = 0;
+        admin_payload[3] = 0;
+        #endif
 
-        // now check if we're done with this update.
-        for(i = 0; i < master_param->client_count; i++)
-        {
-            if(client_list[i].send_remove_device_message)
-            {
-                admin_msg_id = ON_RM_DEV;
-                admin_payload[0] = remove_device_did[0];
-                admin_payload[1] = remove_device_did[1];
-                #ifdef ONE_NET_MULTI_HOP
-                admin_payload[2] = on_base_param->num_mh_devices;
-                admin_payload[3] = on_base_param->num_mh_repeaters;
-                #else
-                // TODO -- should we ban multi-hop just because the master
-                // isn't capable.
-                admin_payload[2] = 0;
-                admin_payload[3] = 0;
-                #endif
-                remove_device_update_in_progress = TRUE;
-                break; // we have one.
-            }
-        }
+        // now send to whoever is due and check if we're done with this update.
+        remove_device_update_in_progress = send_queued_updates(ON_RM_DEV,
+          admin_payload, time_now);
 
         if(!remove_device_update_in_progress)
         {
@@ -3017,7 +3811,6 @@ static void check_updates_in_progress(void)
               &ack);
             // now actually remove the client
             rm_client((const on_encoded_did_t* const) &remove_device_did);
-            return;
         }
     }
 
@@ -3033,30 +3826,21 @@ static void check_updates_in_progress(void)
             }
         }
 
+        admin_payload[0] = add_device_did[0];
+        admin_payload[1] = add_device_did[1];
+        #ifdef ONE_NET_MULTI_HOP
+        admin_payload[2] = on_base_param->num_mh_devices;
+        admin_payload[3] = on_base_param->num_mh_repeaters;
+        #else
+        // TODO -- should we ban multi-hop just because the master
+        // isn't capable.
+        admin_payload[2] = 0;
+        admin_payload[3] = 0;
+        #endif
 
-        add_device_update_in_progress = FALSE;
-
-        // now check if we're done with this update.
-        for(i = 0; i < master_param->client_count; i++)
-        {
-            if(client_list[i].send_add_device_message)
-            {
-                admin_msg_id = ON_ADD_DEV;
-                admin_payload[0] = add_device_did[0];
-                admin_payload[1] = add_device_did[1];
-                #ifdef ONE_NET_MULTI_HOP
-                admin_payload[2] = on_base_param->num_mh_devices;
-                admin_payload[3] = on_base_param->num_mh_repeaters;
-                #else
-                // TODO -- should we ban multi-hop just because the master
-                // isn't capable.
-                admin_payload[2] = 0;
-                admin_payload[3] = 0;
-                #endif
-                add_device_update_in_progress = TRUE;
-                break; // we have one.
-            }
-        }
+        // now send to whoever is due and check if we're done with this update.
+        add_device_update_in_progress = send_queued_updates(ON_ADD_DEV,
+          admin_payload, time_now);
 
         if(!add_device_update_in_progress)
         {
@@ -3066,7 +3850,6 @@ static void check_updates_in_progress(void)
               &ack);
             one_net_memmove(add_device_did, ON_ENCODED_BROADCAST_DID,
               ON_ENCODED_DID_LEN);
-            return;
         }
     }
 
@@ -3074,36 +3857,50 @@ static void check_updates_in_progress(void)
     {
         key_change_requested = FALSE; // already changing it.  No need to
                                       // flag it to change again.
-        key_update_in_progress = FALSE;
 
-        // now check if we're done with this update.
-        for(i = 0; i < master_param->client_count; i++)
+        one_net_memmove(admin_payload, &(on_base_param->current_key[
+          3 * ONE_NET_XTEA_KEY_FRAGMENT_SIZE]),
+          ONE_NET_XTEA_KEY_FRAGMENT_SIZE);
+
+        if(rekey_broadcasts_left && time_now >= rekey_broadcast_time)
         {
-            if(!client_list[i].use_current_key)
+            // Every CLIENT must accept the broadcast's message id, so use
+            // one past the highest one in use.
+            broadcast_device.msg_id = 0;
+            for(i = 0; i < master_param->client_count; i++)
             {
-                key_update_in_progress = TRUE; // at least one device has not
-                                               // been updated
-
-                // if it doesn't sleep, send it out.  Otherwise we'll have to
-                // wait till it checks in.
-                if(!features_device_sleeps(client_list[i].device.features))
+                if(client_list[i].device.msg_id > broadcast_device.msg_id)
                 {
-                    admin_msg_id = ON_NEW_KEY_FRAGMENT;
-                    one_net_memmove(admin_payload, &(on_base_param->current_key[
-                      3 * ONE_NET_XTEA_KEY_FRAGMENT_SIZE]),
-                      ONE_NET_XTEA_KEY_FRAGMENT_SIZE);
-                    break; // we have an update to send.
+                    broadcast_device.msg_id = client_list[i].device.msg_id;
                 }
             }
+
+            if(send_admin_pkt(ON_NEW_KEY_FRAGMENT, &ON_ENCODED_BROADCAST_DID,
+              admin_payload, 0) == ONS_SUCCESS)
+            {
+                rekey_broadcasts_left--;
+                rekey_broadcast_time = time_now +
+                  MS_TO_TICK(ON_REKEY_BROADCAST_INTERVAL_MS);
+            }
+        }
+
+        if(time_now < rekey_activation_time)
+        {
+            return; // give the CLIENTs time to confirm the broadcast key.
         }
 
+        // Only the CLIENTs that have not confirmed the new key are left.
+        // Devices that sleep stay pending, but we'll have to wait till they
+        // check in.
+        key_update_in_progress = send_queued_updates(ON_NEW_KEY_FRAGMENT,
+          admin_payload, time_now);
+
         if(!key_update_in_progress)
         {
             // we don't have any more updates for this, so notify the
             // application code
             one_net_master_update_result(ONE_NET_UPDATE_NETWORK_KEY, NULL,
               &ack);
-            return;
         }
     }
 
@@ -3119,21 +3916,6 @@ static void check_updates_in_progress(void)
               ONE_NET_XTEA_KEY_FRAGMENT_SIZE);
             one_net_master_change_key_fragment(key_fragment);
         }
-        return;
-    }
-
-
-    if(time_now < last_send_time + SEND_INTERVAL || admin_msg_id == 0xFF)
-    {
-        return; // nothing is being updated.
-    }
-
-    // don't worry about filling in any destination addresses.  This message's
-    // recipient list will be adjusted when the message is actually popped.
-    if(send_admin_pkt(admin_msg_id, NULL, admin_payload,
-      MS_TO_TICK(2500)) == ONS_SUCCESS)
-    {
-        last_send_time = time_now;
     }
 }
 
@@ -3184,7 +3966,8 @@ static one_net_status_t send_admin_pkt(const UInt8 admin_msg_id,
 /*!
     \brief Handles admin packets.
 
-    \param[in] SRC The sender of the admin packet.
+    \param[in] pkt The packet the admin message came in.  Its source is the
+      sender of the admin message.
     \param[in] DATA The admin packet.
     \param[in/out] client The CLIENT the message is from if the CLIENT is
       already part of the network.  If the CLIENT is not yet part of the
@@ -3195,20 +3978,22 @@ static one_net_status_t send_admin_pkt(const UInt8 admin_msg_id,
     \return ON_MSG_CONTINUE if processing should continue
             ON_MSG_IGNORE if the message should be ignored
 */
-static on_message_status_t handle_admin_pkt(const on_encoded_did_t * const
-  SRC_DID, const UInt8 * const DATA, on_client_t ** client,
-  on_ack_nack_t* ack_nack)
+static on_message_status_t handle_admin_pkt(const on_pkt_t * const pkt,
+  const UInt8 * const DATA, on_client_t ** client, on_ack_nack_t* ack_nack)
 {
-    on_raw_did_t raw_did;
+    const on_encoded_did_t* SRC_DID;
+    const on_raw_did_t* raw_did;
 
     // TODO -- we need some named constants
-    if(!SRC_DID || !DATA || !client || (DATA[1] != ON_FEATURES_RESP &&
+    if(!pkt || !DATA || !client || (DATA[1] != ON_FEATURES_RESP &&
       !(*client)))
     {
         return ONS_BAD_PARAM;
     } // if the parameters are invalid //
 
-    on_decode(raw_did, *SRC_DID, ON_ENCODED_DID_LEN);
+    SRC_DID = (const on_encoded_did_t*)
+      &(pkt->packet_bytes[ON_ENCODED_SRC_DID_IDX]);
+    raw_did = (const on_raw_did_t*) &(pkt->raw_src_did);
     ack_nack->nack_reason = ON_NACK_RSN_NO_ERROR;
     ack_nack->handle = ON_ACK;
 
@@ -3448,7 +4233,7 @@ static on_message_status_t handle_admin_pkt(const on_encoded_did_t * const
             if((*client)->send_add_device_message)
             {
                 one_net_master_update_result(ONE_NET_UPDATE_ADD_DEVICE,
-                  (const on_raw_did_t*) &raw_did, ack_nack);
+                  raw_did, ack_nack);
             }
 
             (*client)->send_add_device_message = FALSE;
@@ -3465,7 +4250,7 @@ static on_message_status_t handle_admin_pkt(const on_encoded_did_t * const
             if((*client)->send_remove_device_message)
             {
                 one_net_master_update_result(ONE_NET_UPDATE_REMOVE_DEVICE,
-                  (const on_raw_did_t*) &raw_did, ack_nack);
+                  raw_did, ack_nack);
             }
 
             (*client)->send_remove_device_message = FALSE;
@@ -3571,6 +4356,7 @@ static on_message_status_t handle_admin_pkt(const on_encoded_did_t * const
                   ONE_NET_XTEA_KEY_FRAGMENT_SIZE);
                 key_update_in_progress = TRUE;
                 (*client)->use_current_key = FALSE;
+                queue_client_update(*client - client_list);
                 break;
             }
             else
@@ -3578,7 +4364,7 @@ static on_message_status_t handle_admin_pkt(const on_encoded_did_t * const
                 if(!((*client)->use_current_key))
                 {
                     one_net_master_update_result(ONE_NET_UPDATE_NETWORK_KEY,
-                        (const on_raw_did_t*) &raw_did, ack_nack);
+                        raw_did, ack_nack);
                 }
                 (*client)->use_current_key = TRUE;
                 #ifdef AUTO_SAVE
@@ -3663,11 +4449,15 @@ static on_message_status_t handle_admin_pkt(const on_encoded_did_t * const
             }
 
             // they have the right key and no other admin messages need to
-            // go out.  We'll send back the keep-alive interval they should
-            // use.
+            // go out.  We'll send back the time until their next check-in
+            // slot, or the keep-alive interval they should use if they
+            // would take the time as their interval.
             (*client)->use_current_key = TRUE;
             ack_nack->handle = ON_ACK_TIME_MS;
-            ack_nack->payload->ack_time_ms = (*client)->keep_alive_interval;
+            ack_nack->payload->ack_time_ms =
+              features_keep_alive_slot_capable((*client)->device.features) ?
+              keep_alive_slot_delay(*client - client_list) :
+              (*client)->keep_alive_interval;
             break;
         }
 
@@ -3731,7 +4521,6 @@ static on_message_status_t handle_admin_pkt(const on_encoded_did_t * const
 static void on_master_adjust_recipient_list(const on_single_data_queue_t*
   const msg, on_recipient_list_t** recipient_send_list)
 {
-    int i, index;
     on_did_unit_t did_unit;
     on_client_t* client;
 
@@ -3758,6 +4547,18 @@ static void on_master_adjust_recipient_list(const on_single_data_queue_t*
         return;
     }
 
+    if(msg->payload[0] == ON_NEW_KEY_FRAGMENT && is_broadcast_did(
+      (const on_encoded_did_t*) msg->dst_did))
+    {
+        // a key fragment broadcast goes out as is unless the key change is
+        // already done.
+        if(!key_update_in_progress)
+        {
+            *recipient_send_list = NULL;
+        }
+        return;
+    }
+
     did_unit.unit = ONE_NET_DEV_UNIT; // all of these updates go to the device
                                       // as a whole.
 
@@ -3919,117 +4720,122 @@ static void on_master_adjust_recipient_list(const on_single_data_queue_t*
     }
 
 
-    // Pick a random index.  This will be overridden if we find a match when traversing
-    // the client list in the loop below.
+    // These updates are queued for each CLIENT that needs them and sent to
+    // it directly, each with its own backoff (see send_queued_updates), so
+    // the recipient is not swapped for another CLIENT here.  Just make sure
+    // it still needs the update.
     client = NULL;
-    index = one_net_prand(get_tick_count(), master_param->client_count - 1);
-
     if((*recipient_send_list)->num_recipients)
     {
         client = client_info((const on_encoded_did_t*)
           &(*recipient_send_list)->recipient_list[0].did);
+    }
 
-        if(client)
-        {
-            // iterate through the clients till we find the one we're queued
-            // to send.
-            for(i = 0; i < master_param->client_count; i++)
-            {
-                if(client == &client_list[i])
-                {
-                    index = i;
-                    break; // found it.
-                }
-                client = NULL;
-            }
-        }
+    // Sleeping devices don't receive outgoing messages for these particular
+    // updates.  They get them when they check in with keep-alive messages.
+    if(!client || features_device_sleeps(client->device.features) ||
+      (msg->payload[0] == ON_NEW_KEY_FRAGMENT && client->use_current_key) ||
+      (msg->payload[0] == ON_ADD_DEV && !client->send_add_device_message) ||
+      (msg->payload[0] == ON_RM_DEV && !client->send_remove_device_message))
+    {
+        // already sent, or nobody to send it to.  Abort this message.
+        *recipient_send_list = NULL;
     }
+}
 
 
-    // clear the list.  If there was something on it and it still needs to be
-    // sent, we'll add it back in
-    (*recipient_send_list)->num_recipients = 0;
+/*!
+    \brief Handles the CLIENTs that have missed their check-in time.
 
-    for(i = 0; i < master_param->client_count; i++)
-    {
-        if(index >= master_param->client_count)
-        {
-            index = 0; // wraparound.
-        }
-        client = &client_list[index];
-        index++;
+    Only the CLIENTs at the top of check_in_heap, whose check-in time has
+    passed, are looked at.
 
-        // see if we need to send this message fo this client.  We don't need
-        // to send it if...
-        // 1) It's already been sent and the device has verified that it has
-        //    been sent.
-        // 2) The device sleeps.  Sleeping devices don't receive outgoing
-        //    messages for these particular updates.  They get them when they
-        //    check in with keep-alive messages.
+    \return void
+*/
+static void check_clients_for_missed_check_ins(void)
+{
+    UInt16 i;
+    tick_t time_now = get_tick_count();
+    UInt8 pld[4];
+    // each CLIENT is handled at most once.  Near the tick count wrapping,
+    // the new deadline can come out before time_now.
+    UInt16 remaining = check_in_heap_size;
 
-        // TODO -- do we need to check this one?  Presumably it was checked
-        //         before it was queued in the first place?
-        if(features_device_sleeps(client->device.features))
+    while(remaining-- && check_in_heap_size &&
+      client_list[check_in_heap[0]].next_check_in_time < time_now)
+    {
+        i = check_in_heap[0];
+        if(one_net_master_client_missed_check_in(&client_list[i]) &&
+          !features_device_sleeps(client_list[i].device.features))
         {
-            continue;
+            send_admin_pkt(ON_KEEP_ALIVE_QUERY,
+              (const on_encoded_did_t* const) &(client_list[i].device.did),
+              pld, 0);
         }
 
-        if(msg->payload[0] == ON_NEW_KEY_FRAGMENT && client->use_current_key)
-        {
-            // already sent
-            continue;
-        }
-        if(msg->payload[0] == ON_ADD_DEV &&
-          !(client->send_add_device_message))
+        if(check_in_heap_pos[i] == ON_CLIENT_INDEX_NONE)
         {
-            // already sent
-            continue;
-        }
-        if(msg->payload[0] == ON_RM_DEV &&
-          !(client->send_remove_device_message))
-        {
-            // already sent
-            continue;
+            continue; // the application removed the client.
         }
 
-
-        // looks like we should send this one.
-        did_unit.did[0] = client->device.did[0];
-        did_unit.did[1] = client->device.did[1];
-        add_recipient_to_recipient_list(*recipient_send_list, &did_unit);
-        return;
+        // same slack as when the CLIENT checks in, since it may be told to
+        // wait up to half an interval more to reach its slot.
+        client_list[i].next_check_in_time = time_now +
+          MS_TO_TICK(5000 + client_list[i].keep_alive_interval +
+          client_list[i].keep_alive_interval / 2);
+        check_in_heap_update(i);
     }
-
-    // looks like nothing should be sent.  Abort this message.
-    *recipient_send_list = NULL;
 }
 
 
-static void check_clients_for_missed_check_ins(void)
+/*!
+    \brief Finds how long a CLIENT should wait before its next check-in.
+
+    Each CLIENT gets a slot in its keep-alive interval based on its position
+    in client_list, so that CLIENTs that were added together do not all check
+    in at once.  The wait is the time to the CLIENT's next slot that is at
+    least half an interval away, so it is between half an interval and an
+    interval and a half.
+
+    \param[in] list_index The position of the CLIENT in client_list.
+
+    \return The number of ms the CLIENT should wait before checking in again.
+*/
+static UInt32 keep_alive_slot_delay(UInt16 list_index)
 {
-    UInt8 i;
-    tick_t time_now = get_tick_count();
-    UInt8 pld[4];
-    for(i = 0; i < master_param->client_count; i++)
+    UInt32 interval = client_list[list_index].keep_alive_interval;
+    UInt32 phase, delay;
+    UInt16 i, rank = 0;
+
+    if(interval < 2 || master_param->client_count < 2)
+    {
+        return interval;
+    }
+
+    // client_list can have holes, so use the CLIENT's place among the
+    // CLIENTs that are in the list.  This keeps the phase below interval.
+    for(i = 0; i < list_index; i++)
     {
-        if(client_list[i].keep_alive_interval == 0)
+        if(!is_broadcast_did((const on_encoded_did_t*)
+          client_list[i].device.did))
         {
-            continue; // this client is not expected to check in.
-        }
-        if(client_list[i].next_check_in_time < time_now)
-        {
-            if(one_net_master_client_missed_check_in(&client_list[i]) &&
-              !features_device_sleeps(client_list[i].device.features))
-            {
-                send_admin_pkt(ON_KEEP_ALIVE_QUERY,
-                  (const on_encoded_did_t* const) &(client_list[i].device.did),
-                  pld, 0);
-            }
-            client_list[i].next_check_in_time = time_now +
-              MS_TO_TICK(5000 + client_list[i].keep_alive_interval);
+            rank++;
         }
     }
-}
+
+    phase = (interval / master_param->client_count) *
+      (rank % master_param->client_count);
+
+    // time left until this CLIENT's slot comes around again
+    delay = interval - (TICK_TO_MS(get_tick_count()) + interval - phase) %
+      interval;
+    if(delay < interval / 2)
+    {
+        delay += interval;
+    }
+
+    return delay;
+} // keep_alive_slot_delay //
 
 
 
@@ -64,6 +64,10 @@
 //! @{
 
 
+//! Sort key of a vacant peer entry.  Higher than any source unit so that
+//! vacant entries stay at the end of the list.
+#define PEER_VACANT_KEY 0x100
+
 
 //! @} ONE-NET_PEER_const
 //                                  CONSTANTS END
@@ -125,6 +129,10 @@ on_peer_unit_t* const peer = (on_peer_unit_t* const) &peer_storage[0];
 //! @{
 
 
+static UInt16 peer_key(const on_peer_unit_t* const PEER_UNIT);
+static UInt8 peer_lower_bound(const on_peer_unit_t* peer_list, UInt16 key);
+
+
 //! @} ONE-NET_PEER_pri_func
 //                      PRIVATE FUNCTION DECLARATIONS END
 //==============================================================================
@@ -155,6 +163,49 @@ one_net_status_t one_net_reset_peers(void)
 } // one_net_reset_peers //
 
 
+/*!
+    \brief Sorts a peer list by source unit.
+
+    The peer functions keep the peers for each source unit together, in
+    ascending source unit order, with the vacant entries at the end.  This
+    should be called whenever a peer list is loaded from somewhere that may
+    not have kept that order, such as older non-volatile memory.  The sort is
+    stable and takes a single pass over a list that is already in order.
+
+    \param[in/out] peer_list The peer list to sort.  If NULL, the main peer
+      list is used.
+
+    \return void
+*/
+void one_net_sort_peers(on_peer_unit_t* peer_list)
+{
+    UInt8 i, j;
+    on_peer_unit_t temp;
+
+    if(!peer_list)
+    {
+        peer_list = peer; // list not provided, so we use the main list
+    }
+
+    for(i = 1; i < ONE_NET_MAX_PEER_UNIT; i++)
+    {
+        if(peer_key(&peer_list[i - 1]) <= peer_key(&peer_list[i]))
+        {
+            continue;
+        }
+
+        temp = peer_list[i];
+        j = i;
+        while(j > 0 && peer_key(&peer_list[j - 1]) > peer_key(&temp))
+        {
+            peer_list[j] = peer_list[j - 1];
+            j--;
+        }
+        peer_list[j] = temp;
+    }
+} // one_net_sort_peers //
+
+
 /*!
     \brief Counts the number of peers in a peer list.
     
@@ -165,20 +216,12 @@ one_net_status_t one_net_reset_peers(void)
 // TODO -- Do we need/want this function?
 UInt8 one_net_count_peers(const on_peer_unit_t* peer_list)
 {
-    UInt8 i;
     if(!peer_list)
     {
         peer_list = peer; // list not provided, so we use the main list
     }
     
-    for(i = 0; i < ONE_NET_MAX_PEER_UNIT; i++)
-    {
-        if(peer_list[i].peer_unit == ONE_NET_DEV_UNIT)
-        {
-            return i;
-        }
-    }
-    return ONE_NET_MAX_PEER_UNIT;
+    return peer_lower_bound(peer_list, PEER_VACANT_KEY);
 }
 
 
@@ -201,21 +244,12 @@ void add_peers_to_recipient_list(const on_single_data_queue_t*
         return; // not sending to peer list
     }
 
-    for(i = 0; i < ONE_NET_MAX_PEER_PER_TXN; i++)
+    // the peers for a source unit are together, so jump to the first one
+    // and stop after the last.
+    for(i = peer_lower_bound(peer_list, msg->src_unit);
+      i < ONE_NET_MAX_PEER_UNIT && peer_key(&peer_list[i]) == msg->src_unit;
+      i++)
     {
-        // change to INVALID_PEER?
-        if(is_broadcast_did((const on_encoded_did_t*)
-          (&(peer_list[i].peer_did))))
-        {
-            break; // end of peer list reached.
-        }
-
-        if(peer_list[i].src_unit != msg->src_unit)
-        {
-            continue;
-        }
-        
-        // we have a match.
         one_net_memmove(dst_did_unit.did, peer_list[i].peer_did,
           ON_ENCODED_DID_LEN);
         dst_did_unit.unit = peer_list[i].peer_unit;
@@ -245,8 +279,8 @@ one_net_status_t one_net_add_peer_to_list(const UInt8 SRC_UNIT,
   on_peer_unit_t* peer_list, const on_encoded_did_t * const PEER_DID,
   const UInt8 PEER_UNIT)
 {
-    UInt8 vacant_index;
-    UInt8 num_peers_for_src = 0; // number of peers for this source
+    UInt8 i;
+    UInt8 unit_start, unit_end, num_peers;
     
     if(!peer_list)
     {
@@ -254,56 +288,44 @@ one_net_status_t one_net_add_peer_to_list(const UInt8 SRC_UNIT,
     }
     
     // There are a few possibilities
-    // 1.  Peer list is full.  If so, cannot add.  return ONS_RSRC_FULL.
-    // 2.  This peer assignment is already on the unit list.  If so, do nothing,
-	//     return ONS_SUCCESS.
-    // 3.  This peer assignment is not on the unit list, but the unit list is
-	//     full.  If so, do nothing and return ONS_RSRC_FULL.  Note that this is
-    //     a separate criteria than the one directly above, which looked to see
-    //     if the ENTIRE list was full.  This is a check of whether the UNIT
-    //     list is full.  Cannot add.  Return ONS_RSRC_FULL.
-    // 4.  This peer assignment is not on the unit list, and the unit list is
-	//     not full.  If so, proceed to step 5.	
-    // 5.  Insert the new peer assignment at the end of the peer list and
-    //     return ONS_SUCCESS.
-	
-
-    // find a spot to add the peer.  Empty spots should all be at the end and are
-    // represented by ONE_NET_DEV_UNIT.
-    for(vacant_index = 0; vacant_index < ONE_NET_MAX_PEER_UNIT; vacant_index++)
+    // 1.  This peer assignment is already on the unit list.  If so, do
+    //     nothing, return ONS_SUCCESS.
+    // 2.  The unit list is full.  Cannot add.  Return ONS_RSRC_FULL.
+    // 3.  The ENTIRE peer list is full.  Cannot add.  Return ONS_RSRC_FULL.
+    // 4.  Insert the new peer assignment at the end of the unit list, moving
+    //     the units after it down one, and return ONS_SUCCESS.
+    unit_start = peer_lower_bound(peer_list, SRC_UNIT);
+    unit_end = peer_lower_bound(peer_list, (UInt16) SRC_UNIT + 1);
+
+    for(i = unit_start; i < unit_end; i++)
     {
-        if(peer_list[vacant_index].peer_unit == ONE_NET_DEV_UNIT)
+        if(peer_list[i].peer_unit == PEER_UNIT &&
+          one_net_memcmp(peer_list[i].peer_did, *PEER_DID,
+          ON_ENCODED_DID_LEN) == 0)
         {
-            // we have found our insertion point. Insert here.
-            peer_list[vacant_index].src_unit = SRC_UNIT;
-            peer_list[vacant_index].peer_unit = PEER_UNIT;
-            one_net_memmove(peer_list[vacant_index].peer_did,
-              *PEER_DID, ON_ENCODED_DID_LEN);
-            
+            // Already on list.  Do not add.
+            return ONS_SUCCESS;
         }
-        
-        if(peer_list[vacant_index].src_unit == SRC_UNIT)
-        {
-            if(peer_list[vacant_index].peer_unit == PEER_UNIT &&
-              one_net_memcmp(peer_list[vacant_index].peer_did, *PEER_DID,
-              ON_ENCODED_DID_LEN) == 0)
-            {
-                // Already on list.  Do not add.
-                return ONS_SUCCESS;
-            }
-            
-            // add one to the unit listand seeif we're outof room on the list
-            // for this particular unit.
-            num_peers_for_src++;
-            if(num_peers_for_src >= ONE_NET_MAX_PEER_PER_TXN)
-            {
-                return ONS_RSRC_FULL;
-            }
-        }      
-	}
-     
-    // if we got to here, then all spots are taken, so we cannot add.
-	return ONS_RSRC_FULL;
+    }
+
+    if(unit_end - unit_start >= ONE_NET_MAX_PEER_PER_TXN)
+    {
+        return ONS_RSRC_FULL;
+    }
+
+    num_peers = peer_lower_bound(peer_list, PEER_VACANT_KEY);
+    if(num_peers >= ONE_NET_MAX_PEER_UNIT)
+    {
+        return ONS_RSRC_FULL;
+    }
+
+    one_net_memmove(&peer_list[unit_end + 1], &peer_list[unit_end],
+      (num_peers - unit_end) * sizeof(on_peer_unit_t));
+    peer_list[unit_end].src_unit = SRC_UNIT;
+    peer_list[unit_end].peer_unit = PEER_UNIT;
+    one_net_memmove(peer_list[unit_end].peer_did, *PEER_DID,
+      ON_ENCODED_DID_LEN);
+	return ONS_SUCCESS;
 } // one_net_add_peer_to_list //
 
 
@@ -330,61 +352,62 @@ one_net_status_t one_net_remove_peer_from_list(const UInt8 SRC_UNIT,
 {
     // note : "Wildcards are units with value ONE_NET_DEV_UNIT and
     // DIDs of INVALID_PEER_DID.  We go through the list and check each element
-    // to see if there is a match.  If so, we delete.
+    // to see if there is a match.  Elements that are kept are moved up over
+    // the deleted ones in the same pass, so the order is kept.
     
-    SInt8 i; // signed because this can be negative
+    UInt8 i, start, end, keep;
+    on_peer_unit_t empty_peer = {{0xB4, 0xB4}, ONE_NET_DEV_UNIT,
+      ONE_NET_DEV_UNIT};
     
     if(!peer_list)
     {
         peer_list = peer;
     }
 
-    
-    for(i = 0; i < ONE_NET_MAX_PEER_UNIT; i++)
+    end = peer_lower_bound(peer_list, PEER_VACANT_KEY);
+    if(SRC_UNIT == ONE_NET_DEV_UNIT)
+    {
+        start = 0;
+    }
+    else
+    {
+        // only the peers for this source unit can match.
+        start = peer_lower_bound(peer_list, SRC_UNIT);
+    }
+
+    for(i = start, keep = start; i < end; i++)
     {
-        // check to see if we are at the end of the list
-        if(peer_list[i].peer_unit == ONE_NET_DEV_UNIT)
-        {
-            // end of the list.
-            break;
-        }        
-        
-        // check the did criteria.
-        if(!on_encoded_did_equal(PEER_DID, &INVALID_PEER) &&
-           !on_encoded_did_equal(PEER_DID, (const on_encoded_did_t* const)
-           &(peer_list[i].peer_did)))
-        {
-            continue; // not a match or wildcard
-        }
-        
-        // check the source unit
         if(SRC_UNIT != ONE_NET_DEV_UNIT && SRC_UNIT != peer_list[i].src_unit)
         {
-            continue; // not a match or wildcard
-        }      
+            break; // past the peers for this source unit
+        }
         
-        // check the peer unit
-        if(PEER_UNIT != ONE_NET_DEV_UNIT && PEER_UNIT !=
-           peer_list[i].peer_unit)
+        // check the did criteria and the peer unit.  If either does not
+        // match and is not a wildcard, keep this element.
+        if((!on_encoded_did_equal(PEER_DID, &INVALID_PEER) &&
+           !on_encoded_did_equal(PEER_DID, (const on_encoded_did_t* const)
+           &(peer_list[i].peer_did))) || (PEER_UNIT != ONE_NET_DEV_UNIT &&
+           PEER_UNIT != peer_list[i].peer_unit))
         {
-            continue; // not a match or wildcard
+            if(keep != i)
+            {
+                peer_list[keep] = peer_list[i];
+            }
+            keep++;
         }
+    }
 
-        
-        // this element should be removed
-        
-        
-        // move everything after up one spot
-        one_net_memmove(&peer_list[i], &peer_list[i+1], (ONE_NET_MAX_PEER_UNIT
-           - i - 1) * sizeof(on_peer_unit_t));
-           
-        // now blank out the last spot if not already blanked out.
-        peer_list[ONE_NET_MAX_PEER_UNIT - 1].peer_unit = ONE_NET_DEV_UNIT;
-        
-        i--; // we just deleted and we're going to increment at the top of the
-             // loop, but since the indexes have changed, we want to keep our
-             // loop index the same, so decrement here to cancel things out.
+    if(keep == i)
+    {
+        return ONS_SUCCESS; // nothing was removed
     }
+
+    // move everything after the removed elements up and blank out the spots
+    // that are left at the end.
+    one_net_memmove(&peer_list[keep], &peer_list[i],
+      (end - i) * sizeof(on_peer_unit_t));
+    one_net_memset_block(&peer_list[keep + end - i], sizeof(empty_peer),
+      i - keep, &empty_peer);
     
     return ONS_SUCCESS;
 }
@@ -404,6 +427,59 @@ one_net_status_t one_net_remove_peer_from_list(const UInt8 SRC_UNIT,
 //! @{
 
 
+/*!
+    \brief Returns the key a peer list is sorted on.
+
+    \param[in] PEER_UNIT The peer list entry.
+
+    \return The source unit of the entry, or PEER_VACANT_KEY if the entry is
+      vacant.
+*/
+static UInt16 peer_key(const on_peer_unit_t* const PEER_UNIT)
+{
+    if(PEER_UNIT->peer_unit == ONE_NET_DEV_UNIT)
+    {
+        return PEER_VACANT_KEY;
+    }
+
+    return PEER_UNIT->src_unit;
+} // peer_key //
+
+
+/*!
+    \brief Finds the first entry in a sorted peer list with a key of at least
+      key.
+
+    \param[in] peer_list The peer list to search.
+    \param[in] key The source unit, or PEER_VACANT_KEY to find the first
+      vacant entry.
+
+    \return The index of the first entry whose key is at least key.
+            ONE_NET_MAX_PEER_UNIT if there is no such entry.
+*/
+static UInt8 peer_lower_bound(const on_peer_unit_t* peer_list, UInt16 key)
+{
+    UInt8 low = 0;
+    UInt8 high = ONE_NET_MAX_PEER_UNIT;
+    UInt8 mid;
+
+    while(low < high)
+    {
+        mid = low + (high - low) / 2;
+        if(peer_key(&peer_list[mid]) < key)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+} // peer_lower_bound //
+
+
 //! @} ONE-NET_PEER_pri_func
 //                      PRIVATE FUNCTION IMPLEMENTATION END
 //==============================================================================
@@ -63,6 +63,27 @@
 //! \ingroup one_net_memory
 //! @{
 
+
+/*!
+    The heap is split evenly between ONE_NET_HEAP_NUM_CLASSES size classes.
+    Class n hands out blocks of ONE_NET_HEAP_MIN_BLOCK_SIZE << n bytes, so its
+    share of the heap holds HEAP_CLASS_SHARE / (ONE_NET_HEAP_MIN_BLOCK_SIZE <<
+    n) blocks.  Each class keeps a list of its free blocks, with the index of
+    the next free block stored in the first byte of each free block.
+*/
+enum
+{
+    //! Bytes of heap_buffer given to each size class
+    HEAP_CLASS_SHARE = ONE_NET_HEAP_SIZE / ONE_NET_HEAP_NUM_CLASSES,
+
+    //! Upper bound on the total number of blocks in all of the classes
+    HEAP_MAX_BLOCKS = ONE_NET_HEAP_SIZE / ONE_NET_HEAP_MIN_BLOCK_SIZE,
+
+    //! Marks the end of a free list
+    HEAP_NO_BLOCK = 0xFF
+};
+
+
 //! @} one_net_memory_const
 //                                  CONSTANTS END
 //==============================================================================
@@ -77,6 +98,21 @@
 //                                  TYPEDEFS END
 //==============================================================================
 
+//==============================================================================
+//                              PUBLIC VARIABLES
+//! \defgroup one_net_memory_pub_var
+//! \ingroup one_net_memory
+//! @{
+
+
+//! Usage statistics for the heap
+one_net_heap_stats_t one_net_heap_stats;
+
+
+//! @} one_net_memory_pub_var
+//                              PUBLIC VARIABLES END
+//==============================================================================
+
 //==============================================================================
 //                              PRIVATE VARIABLES
 //! \defgroup one_net_memory_pri_var
@@ -86,15 +122,21 @@
 
 static UInt8 heap_buffer[ONE_NET_HEAP_SIZE];
 
-// TODO -- experiment with removing the initializer.  Since this is a static
-// variable, if the initializer is left off, it will still initialize to all 0,
-// I think.  Need to confirm this with the standard to be positive.  There have
-// been reports that using the initializer versus not using it can cause a
-// difference in code space.
-static heap_entry_t heap_entry[ONE_NET_HEAP_NUM_ENTRIES] = {{0,0}};
+//! The number of bytes requested for each block, indexed by
+//! class_first_block[class] + block.  0 if the block is free.
+static UInt8 block_len[HEAP_MAX_BLOCKS];
+
+//! The first free block in each class
+static UInt8 free_head[ONE_NET_HEAP_NUM_CLASSES];
+
+//! Index into block_len of the first block in each class
+static UInt8 class_first_block[ONE_NET_HEAP_NUM_CLASSES];
+
+//! TRUE once the free lists have been built
+static BOOL heap_initialized = FALSE;
 
 
-//! @} one_net_memory_pub_var
+//! @} one_net_memory_pri_var
 //                              PRIVATE VARIABLES END
 //==============================================================================
 
@@ -104,6 +146,12 @@ static heap_entry_t heap_entry[ONE_NET_HEAP_NUM_ENTRIES] = {{0,0}};
 //! \ingroup one_net_memory
 //! @{
 
+
+static void heap_init(void);
+static BOOL heap_find_block(const void* const ptr, UInt8* const cls,
+  UInt8* const block);
+
+
 //! @} one_net_memory_pri_func
 //                      PRIVATE FUNCTION DECLARATIONS END
 //=============================================================================
@@ -121,6 +169,10 @@ static heap_entry_t heap_entry[ONE_NET_HEAP_NUM_ENTRIES] = {{0,0}};
     beginning of the block.  The content of the newly allocated block of
     memory is not initialized,remaining with indeterminate values.
 
+    The block comes from the smallest size class that fits.  If that class
+    has nothing free, the next larger class is tried, and so on.  Requests
+    larger than the blocks of the largest class always fail.
+
 
     \param[in] size Size of the requested memory block, in bytes.
    
@@ -133,77 +185,66 @@ static heap_entry_t heap_entry[ONE_NET_HEAP_NUM_ENTRIES] = {{0,0}};
 */
 void* one_net_malloc(UInt8 size)
 {
-    SInt8 i;
+    UInt8 cls, block;
+    UInt8* ptr;
+    UInt16 bytes_free = 0;
 
-    if(heap_entry[ONE_NET_HEAP_NUM_ENTRIES - 1].size != 0)
+    if(!heap_initialized)
     {
-        return NULL; // all slots taken
+        heap_init();
     }
-    
-    if(size == 0 || size > ONE_NET_HEAP_SIZE)
+
+    if(size == 0)
     {
-        return NULL; // requested size is 0 or bigger than buffer.
+        return NULL; // requested size is 0
     }
     
-    // see if everything is empty
-    if(heap_entry[0].size == 0)
+    for(cls = 0; cls < ONE_NET_HEAP_NUM_CLASSES; cls++)
     {
-        // use the first spot
-        heap_entry[0].index = 0;
-        heap_entry[0].size = size;
-        return &heap_buffer[0];
+        if(free_head[cls] != HEAP_NO_BLOCK &&
+          size <= one_net_heap_block_size(cls))
+        {
+            break;
+        }
+        
+        bytes_free += (UInt16)(one_net_heap_block_count(cls) -
+          one_net_heap_stats.blocks_in_use[cls]) *
+          one_net_heap_block_size(cls);
     }
     
-    // see if the last slot is free
-    for(i = 1; i < ONE_NET_HEAP_NUM_ENTRIES; i++)
+    if(cls >= ONE_NET_HEAP_NUM_CLASSES)
     {
-        if(heap_entry[i].size == 0)
+        one_net_heap_stats.alloc_fail++;
+        if(bytes_free >= size)
         {
-            if(size <= ONE_NET_HEAP_SIZE - heap_entry[i-1].index -
-              heap_entry[i-1].size)
-            {
-                heap_entry[i].index = heap_entry[i-1].index +
-                  heap_entry[i-1].size;
-                heap_entry[i].size = size;
-                return &heap_buffer[heap_entry[i].index];
-            }
-            break; // last slot is not free
+            // there was room, just not in one piece
+            one_net_heap_stats.frag_fail++;
         }
+        return NULL;
     }
     
-    // now see if there are any gaps.  First check the first index.
-    if(size <= heap_entry[0].index)
+    block = free_head[cls];
+    ptr = &heap_buffer[cls * HEAP_CLASS_SHARE +
+      block * one_net_heap_block_size(cls)];
+    free_head[cls] = *ptr;
+    block_len[class_first_block[cls] + block] = size;
+
+    one_net_heap_stats.bytes_requested += size;
+    one_net_heap_stats.bytes_in_use += one_net_heap_block_size(cls);
+    if(one_net_heap_stats.bytes_in_use > one_net_heap_stats.peak_bytes_in_use)
     {
-        // move everything up 1
-        one_net_memmove(&heap_entry[1], &heap_entry[0],
-          (ONE_NET_HEAP_NUM_ENTRIES - 1) * sizeof(heap_entry_t));
-        heap_entry[0].index = 0;
-        heap_entry[0].size = size;
-        return &heap_buffer[0];
+        one_net_heap_stats.peak_bytes_in_use = one_net_heap_stats.bytes_in_use;
     }
     
-    // now look elsewhere
-    for(i = 1; i < ONE_NET_HEAP_NUM_ENTRIES; i++)
+    one_net_heap_stats.blocks_in_use[cls]++;
+    if(one_net_heap_stats.blocks_in_use[cls] >
+      one_net_heap_stats.peak_blocks_in_use[cls])
     {
-        if(heap_entry[i].size == 0)
-        {
-            return NULL; // no gaps
-        }
-        
-        if(size <= heap_entry[i].index - heap_entry[i-1].index -
-          heap_entry[i-1].size)
-        {
-            // move everything up 1
-            one_net_memmove(&heap_entry[i+1], &heap_entry[i],
-              (ONE_NET_HEAP_NUM_ENTRIES - 1) * sizeof(heap_entry_t));
-            heap_entry[i].index = heap_entry[i-1].index + heap_entry[i-1].size;
-            heap_entry[i].size = size;
-            return &heap_buffer[heap_entry[i].index];
-        }
+        one_net_heap_stats.peak_blocks_in_use[cls] =
+          one_net_heap_stats.blocks_in_use[cls];
     }
     
-    // should never get here?
-    return NULL;
+    return ptr;
 }
 
 
@@ -256,6 +297,8 @@ void* one_net_calloc(UInt8 size, UInt8 value)
     new location is returned. The content of the memory block is preserved up to
     the lesser of the new and old sizes, even if the block is moved. If the new
     size is larger, the value of the newly allocated portion is indeterminate.
+    If the new size still fits in the block already held, the block is not
+    moved.
 
     In case that ptr is NULL, the function behaves exactly as malloc, assigning
     a new block of size bytes and returning a pointer to the beginning of it.
@@ -284,38 +327,44 @@ void* one_net_calloc(UInt8 size, UInt8 value)
 */
 void* one_net_realloc(void* ptr, UInt8 size)
 {
-    UInt8 i;
+    UInt8 cls, block, old_len;
+    void* new_ptr;
     
     if(ptr == NULL)
     {
         return one_net_malloc(size);
     }
     
-    for(i = 0; i < ONE_NET_HEAP_NUM_ENTRIES; i++)
+    if(!heap_find_block(ptr, &cls, &block))
     {
-        if(heap_entry[i].size > 0 && ptr == &heap_buffer[heap_entry[i].index])
-        {
-            void* new_ptr;
-            UInt8 copy_size = (heap_entry[i].size < size ? heap_entry[i].size :
-              size); // lesser of the two sizes.
-
-            one_net_free(&heap_buffer[heap_entry[i].index]);
-            if(size == 0)
-            {
-                return NULL;
-            }
-            
-            new_ptr = one_net_malloc(size);
-            if(new_ptr == NULL)
-            {
-                return NULL;
-            }
-            one_net_memmove(new_ptr, ptr, copy_size);
-            return new_ptr;
-        }
+        return NULL; // bad pointer
+    }
+    
+    if(size == 0)
+    {
+        one_net_free(ptr);
+        return NULL;
+    }
+    
+    old_len = block_len[class_first_block[cls] + block];
+    if(size <= one_net_heap_block_size(cls))
+    {
+        // still fits
+        one_net_heap_stats.bytes_requested += size;
+        one_net_heap_stats.bytes_requested -= old_len;
+        block_len[class_first_block[cls] + block] = size;
+        return ptr;
+    }
+    
+    new_ptr = one_net_malloc(size);
+    if(new_ptr == NULL)
+    {
+        return NULL;
     }
     
-    return NULL; // bad pointer
+    one_net_memmove(new_ptr, ptr, old_len);
+    one_net_free(ptr);
+    return new_ptr;
 }
 
 
@@ -338,30 +387,51 @@ void* one_net_realloc(void* ptr, UInt8 size)
 */
 void one_net_free(void* ptr)
 {
-    UInt8 i;
-    if(!ptr)
+    UInt8 cls, block;
+    UInt8* len;
+    
+    if(!heap_find_block(ptr, &cls, &block))
     {
-        return;
+        return; // NULL, not from the heap, or not allocated
     }
-    for(i = 0; i < ONE_NET_HEAP_NUM_ENTRIES; i++)
-    {
-        if(heap_entry[i].size > 0)
-        {
-            if(ptr == &heap_buffer[heap_entry[i].index])
-            {
-                if(i < ONE_NET_HEAP_NUM_ENTRIES - 1)
-                {
-                    one_net_memmove(&heap_entry[i], &heap_entry[i+1],
-                      (ONE_NET_HEAP_NUM_ENTRIES - i - 1) *
-                      sizeof(heap_entry_t));
-                }
-                heap_entry[ONE_NET_HEAP_NUM_ENTRIES - 1].size = 0;
-            }
-        }
-    }
+    
+    len = &block_len[class_first_block[cls] + block];
+    one_net_heap_stats.bytes_requested -= *len;
+    one_net_heap_stats.bytes_in_use -= one_net_heap_block_size(cls);
+    one_net_heap_stats.blocks_in_use[cls]--;
+    *len = 0;
+    
+    *((UInt8*) ptr) = free_head[cls];
+    free_head[cls] = block;
 } // one_net_free //
 
 
+/*!
+    \brief Returns the size of the blocks in a size class.
+    
+    \param[in] cls The size class, 0 being the smallest.
+    
+    \return The number of bytes in each block of the class.
+*/
+UInt8 one_net_heap_block_size(UInt8 cls)
+{
+    return (UInt8)(ONE_NET_HEAP_MIN_BLOCK_SIZE << cls);
+}
+
+
+/*!
+    \brief Returns the number of blocks in a size class.
+    
+    \param[in] cls The size class, 0 being the smallest.
+    
+    \return The number of blocks the class holds.
+*/
+UInt8 one_net_heap_block_count(UInt8 cls)
+{
+    return (UInt8)(HEAP_CLASS_SHARE / one_net_heap_block_size(cls));
+}
+
+
 
 
 
@@ -370,8 +440,8 @@ void one_net_free(void* ptr)
 #include "oncli.h"
 void print_mem(void)
 {
-    oncli_send_msg("Heap Entry\n");
-    xdump((UInt8*) &heap_entry[0], sizeof(heap_entry));
+    oncli_send_msg("Block Lengths\n");
+    xdump((UInt8*) &block_len[0], sizeof(block_len));
     oncli_send_msg("Heap Buffer\n");
     xdump((UInt8*) &heap_buffer[0], ONE_NET_HEAP_SIZE);
 }
@@ -380,10 +450,6 @@ UInt8* get_loc(UInt8 index)
     return &heap_buffer[index];
 }
 #endif
-
-
-
-// TODO -- write one_net_calloc and one_net_realloc functions
 
 
 //! @} one_net_memory_pub_func
@@ -396,6 +462,85 @@ UInt8* get_loc(UInt8 index)
 //! \ingroup one_net_memory
 //! @{
 
+
+/*!
+    \brief Builds the free lists for each size class.
+    
+    \return void
+*/
+static void heap_init(void)
+{
+    UInt8 cls, block, count;
+    UInt8 first_block = 0;
+    UInt8* ptr;
+    
+    for(cls = 0; cls < ONE_NET_HEAP_NUM_CLASSES; cls++)
+    {
+        count = one_net_heap_block_count(cls);
+        class_first_block[cls] = first_block;
+        first_block += count;
+        
+        // chain the blocks together, lowest first
+        free_head[cls] = HEAP_NO_BLOCK;
+        for(block = count; block > 0; block--)
+        {
+            ptr = &heap_buffer[cls * HEAP_CLASS_SHARE +
+              (block - 1) * one_net_heap_block_size(cls)];
+            *ptr = free_head[cls];
+            free_head[cls] = block - 1;
+        }
+    }
+    
+    one_net_memset(block_len, 0, sizeof(block_len));
+    one_net_memset(&one_net_heap_stats, 0, sizeof(one_net_heap_stats));
+    heap_initialized = TRUE;
+}
+
+
+/*!
+    \brief Finds which block of which size class a pointer refers to.
+    
+    \param[in] ptr The pointer returned when the block was allocated.
+    \param[out] cls The size class of the block.
+    \param[out] block The block's index within its size class.
+    
+    \return TRUE if ptr is the start of an allocated block.
+            FALSE otherwise.
+*/
+static BOOL heap_find_block(const void* const ptr, UInt8* const cls,
+  UInt8* const block)
+{
+    UInt16 offset;
+    
+    if(!heap_initialized || (const UInt8*) ptr < heap_buffer ||
+      (const UInt8*) ptr >= &heap_buffer[ONE_NET_HEAP_SIZE])
+    {
+        return FALSE;
+    }
+    
+    offset = (const UInt8*) ptr - heap_buffer;
+    *cls = offset / HEAP_CLASS_SHARE;
+    if(*cls >= ONE_NET_HEAP_NUM_CLASSES)
+    {
+        return FALSE;
+    }
+    
+    offset -= *cls * HEAP_CLASS_SHARE;
+    if(offset % one_net_heap_block_size(*cls))
+    {
+        return FALSE; // not the start of a block
+    }
+    
+    *block = offset / one_net_heap_block_size(*cls);
+    if(*block >= one_net_heap_block_count(*cls))
+    {
+        return FALSE; // in the unused space at the end of the share
+    }
+    
+    return (block_len[class_first_block[*cls] + *block] != 0);
+}
+
+
 //! @} one_net_memory_pri_func
 //                      PRIVATE FUNCTION IMPLEMENTATION END
 //==============================================================================
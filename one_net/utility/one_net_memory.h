@@ -49,6 +49,7 @@
 
 #include "config_options.h"
 #include "one_net_types.h"
+#include "one_net_port_const.h"
 
 
 #ifdef ONE_NET_MEMORY
@@ -71,11 +72,27 @@
 //! @{
 
 
+/*!
+    \brief Usage statistics for the heap.
+    
+    Internal fragmentation is bytes_in_use - bytes_requested.  frag_fail
+    counts failed allocations that would have fit in the bytes that were free
+    if those bytes had been in one block.
+*/
 typedef struct
 {
-    UInt8 index;
-    UInt8 size;
-} heap_entry_t;
+    UInt16 bytes_requested;     //!< bytes asked for by the live allocations
+    UInt16 bytes_in_use;        //!< block bytes held by the live allocations
+    UInt16 peak_bytes_in_use;   //!< most block bytes ever held at once
+    UInt16 alloc_fail;          //!< allocations that could not be made
+    UInt16 frag_fail;           //!< failures with enough bytes free overall
+    
+    //! blocks currently allocated in each size class
+    UInt8 blocks_in_use[ONE_NET_HEAP_NUM_CLASSES];
+    
+    //! most blocks ever allocated at once in each size class
+    UInt8 peak_blocks_in_use[ONE_NET_HEAP_NUM_CLASSES];
+} one_net_heap_stats_t;
 
 
 //! @} one_net_memory_typedefs
@@ -84,6 +101,20 @@ typedef struct
 
 
 
+//==============================================================================
+//                              PUBLIC VARIABLES
+//! \defgroup one_net_memory_pub_var
+//! \ingroup one_net_memory
+//! @{
+
+
+extern one_net_heap_stats_t one_net_heap_stats;
+
+
+//! @} one_net_memory_pub_var
+//                              PUBLIC VARIABLES END
+//==============================================================================
+
 //==============================================================================
 //                      PUBLIC FUNCTION DECLARATIONS
 //! \defgroup one_net_memory_pub_func
@@ -95,6 +126,9 @@ void* one_net_malloc(UInt8 size);
 void* one_net_calloc(UInt8 size, UInt8 value);
 void* one_net_realloc(void* ptr, UInt8 size);
 void one_net_free(void* ptr);
+
+UInt8 one_net_heap_block_size(UInt8 cls);
+UInt8 one_net_heap_block_count(UInt8 cls);
 
 // temporary debugging --  will be deleted
 #ifdef DEBUGGING_TOOLS
@@ -329,6 +329,47 @@ BOOL ont_inactive_or_expired(const UInt8 TIMER)
 } // ont_inactive_or_expired //
 
 
+/*!
+    \brief Finds the number of ticks until the soonest active timer expires.
+
+    Inactive timers are ignored, and so are timers that have already
+    expired.  Timers such as the clear channel and response timers are left
+    active after they expire since nothing checks them again, so counting
+    them would keep a device from ever sleeping.  Devices that sleep use this
+    to find out how long they can stay asleep before some timer needs
+    attention.
+
+    \param[out] time_remaining The number of ticks until the soonest active
+      timer expires.  Not changed if no timer is running.
+
+    \return TRUE if at least one active timer has not expired yet.
+            FALSE otherwise.
+*/
+BOOL ont_next_expiration(tick_t* const time_remaining)
+{
+    UInt8 i;
+    BOOL found = FALSE;
+
+    update_timers();
+
+    for(i = 0; i < ONT_NUM_TIMERS; i++)
+    {
+        if(!timer[i].active || timer[i].tick == 0)
+        {
+            continue;
+        } // if the timer is not running or has already expired //
+
+        if(!found || timer[i].tick < *time_remaining)
+        {
+            *time_remaining = timer[i].tick;
+            found = TRUE;
+        } // if this timer expires sooner //
+    } // loop through the timers //
+
+    return found;
+} // ont_next_expiration //
+
+
 #ifdef DEBUGGING_TOOLS
 #include "oncli.h"
 void print_intervals(void)
@@ -241,6 +241,7 @@ BOOL ont_stop_timer(const UInt8 TIMER);
 BOOL ont_active(const UInt8 TIMER);
 BOOL ont_expired(const UInt8 TIMER);
 BOOL ont_inactive_or_expired(const UInt8 TIMER);
+BOOL ont_next_expiration(tick_t* const time_remaining);
 
 
 void pause_timer(UInt8 TIMER);
@@ -69,6 +69,12 @@ enum
 //! Duration the client listens for an invite.  10 minutes.
 #define ONE_NET_CLIENT_INVITE_DURATION 600000
 
+//! Define this to add a random time, up to this many ms, to each keep-alive
+//! interval so that CLIENTs which were started together drift apart.
+#ifndef ONE_NET_KEEP_ALIVE_JITTER_MS
+    // #define ONE_NET_KEEP_ALIVE_JITTER_MS 2000
+#endif
+
 
 
 //                                  CONSTANTS END
@@ -197,7 +197,16 @@ enum
     // to use malloc, calloc, realloc, free from stdlib.h.
     ONE_NET_HEAP_SIZE = 100,
     
-    ONE_NET_HEAP_NUM_ENTRIES = 5
+    // The heap is split evenly between this many pools.  Each pool hands
+    // out blocks twice the size of the one before it.  No allocation can be
+    // larger than the blocks of the last pool, ONE_NET_HEAP_MIN_BLOCK_SIZE <<
+    // (ONE_NET_HEAP_NUM_CLASSES - 1) bytes, which is 32 bytes with the values
+    // here.  To allow larger allocations, add pools, and make the heap big
+    // enough that each pool's share still holds one of the largest blocks.
+    ONE_NET_HEAP_NUM_CLASSES = 3,
+    
+    // Size of the blocks in the smallest pool.
+    ONE_NET_HEAP_MIN_BLOCK_SIZE = 8
 };
 #endif
 
@@ -246,9 +255,46 @@ enum
 
 //! Default chunk delay for block / stream.
 #define DEFAULT_BS_CHUNK_DELAY 100
+
+//! Define this to be the source of more than one block / stream transfer at
+//! a time.  The transfers take turns during each other's chunk pauses.
+#ifndef ON_BS_MAX_SESSIONS
+//    #define ON_BS_MAX_SESSIONS 4
+#endif
 #endif
 
 
+//! Define this to let single transactions to other devices go ahead while a
+//! device that did not respond waits for its retry.
+#ifndef ON_SINGLE_TXN_WINDOW
+//    #define ON_SINGLE_TXN_WINDOW 4
+#endif
+
+
+//! Define this to send status messages queued for the same device within
+//! ON_COALESCE_HOLD_MS of each other as one extended single message.  The
+//! receiving devices must have firmware that understands
+//! ON_COALESCED_APP_MSG.
+#ifndef ON_COALESCE_SINGLES
+//    #define ON_COALESCE_SINGLES
+#endif
+
+
+//! Define this to accept messages that arrive out of order, as long as
+//! their message ids are recent and have not been received before.
+#ifndef ON_MSG_ID_WINDOW
+//    #define ON_MSG_ID_WINDOW
+#endif
+
+
+//! Define this to keep counters of the time spent in each ONE-NET state,
+//! the statuses returned by the packet handlers, busy channels, retries, and
+//! packets sent and received by type.  The "stats" CLI command shows them.
+#ifndef ON_STATS
+//    #define ON_STATS
+#endif
+
+
 
 //! @} ONE-NET_port_const_const
 //                                  CONSTANTS END